@@ -0,0 +1,537 @@
+// Benchmarks for the load, mesh, sample, blacken, ray picking and export stages.
+//
+// Build it like the viewer, with benchmark.cpp in place of main.cpp, e.g.
+//   g++ -O2 -std=c++17 benchmark.cpp custom_math.cpp uv_camera.cpp ogt_vox.cpp -o vox_benchmark -lGLEW -lglut -lGL -lpthread
+//
+// Usage: vox_benchmark [--iterations N] [--sizes N,N,...] [--threads N] [--greedy] [--rasterize] [file.vox ...]
+// With no files, chr_knight.vox is used. Each size N adds a synthetic N*N*N model.
+
+#include "main.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi")
+#else
+#include <sys/resource.h>
+#endif
+
+
+// Peak resident set size of this process, in bytes
+size_t get_peak_rss(void)
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return counters.PeakWorkingSetSize;
+
+	return 0;
+#else
+	rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+
+#ifdef __APPLE__
+	return static_cast<size_t>(usage.ru_maxrss);
+#else
+	return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+// Swallows the progress output of the functions being timed
+class null_buffer : public streambuf
+{
+protected:
+	int overflow(int c)
+	{
+		return c;
+	}
+};
+
+class stage_timer
+{
+public:
+	string name;
+	string unit;
+	vector<double> seconds;
+	double work_per_run = 0; // Amount of work per run, in units
+
+	template<class T>
+	void run(const size_t iterations, T func)
+	{
+		null_buffer nb;
+
+		for (size_t i = 0; i < iterations; i++)
+		{
+			streambuf* old_buffer = cout.rdbuf(&nb);
+
+			const std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+			func();
+			const std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+
+			cout.rdbuf(old_buffer);
+
+			seconds.push_back(std::chrono::duration<double>(end - start).count());
+		}
+	}
+
+	void report(void) const
+	{
+		if (seconds.empty())
+			return;
+
+		vector<double> sorted = seconds;
+		sort(sorted.begin(), sorted.end());
+
+		const double median = sorted[sorted.size() / 2];
+		const double p95 = sorted[std::min(sorted.size() - 1, static_cast<size_t>(0.95 * sorted.size()))];
+
+		cout << "  " << setw(24) << left << name << right
+			<< " median " << setw(10) << fixed << setprecision(3) << median * 1000.0 << " ms"
+			<< "  p95 " << setw(10) << p95 * 1000.0 << " ms";
+
+		if (work_per_run > 0 && median > 0)
+			cout << "  " << setw(12) << setprecision(1) << work_per_run / median << " " << unit << "/s";
+
+		cout << endl;
+	}
+};
+
+// ogt_vox_write_func that appends to the ofstream passed as user_data
+bool write_to_ofstream(const void* data, uint32_t data_size, void* user_data)
+{
+	ofstream& out = *static_cast<ofstream*>(user_data);
+	out.write(static_cast<const char*>(data), data_size);
+
+	return !out.fail();
+}
+
+// Writes a solid sphere of the given edge size, with bands of colour, to a .vox file
+bool write_synthetic_model(const size_t size, const char* file_name)
+{
+	vector<uint8_t> voxel_data(size * size * size, 0);
+
+	const float radius = size / 2.0f;
+
+	for (size_t z = 0; z < size; z++)
+	{
+		for (size_t y = 0; y < size; y++)
+		{
+			for (size_t x = 0; x < size; x++)
+			{
+				const float dx = x + 0.5f - radius;
+				const float dy = y + 0.5f - radius;
+				const float dz = z + 0.5f - radius;
+
+				if (dx * dx + dy * dy + dz * dz <= radius * radius)
+					voxel_data[x + y * size + z * size * size] = static_cast<uint8_t>(1 + (z * 8 / size));
+			}
+		}
+	}
+
+	ogt_vox_model model = {};
+	model.size_x = static_cast<uint32_t>(size);
+	model.size_y = static_cast<uint32_t>(size);
+	model.size_z = static_cast<uint32_t>(size);
+	model.voxel_data = &voxel_data[0];
+
+	const ogt_vox_model* models[1] = { &model };
+
+	ogt_vox_transform identity = {};
+	identity.m00 = identity.m11 = identity.m22 = identity.m33 = 1.0f;
+
+	ogt_vox_instance instance = {};
+	instance.transform = identity;
+	instance.model_index = 0;
+	instance.layer_index = 0;
+	instance.group_index = 0;
+
+	ogt_vox_layer layer = {};
+	layer.color.r = layer.color.g = layer.color.b = layer.color.a = 255;
+
+	ogt_vox_group group = {};
+	group.transform = identity;
+	group.parent_group_index = k_invalid_group_index;
+
+	ogt_vox_scene scene = {};
+	scene.num_models = 1;
+	scene.num_instances = 1;
+	scene.num_layers = 1;
+	scene.num_groups = 1;
+	scene.models = models;
+	scene.instances = &instance;
+	scene.layers = &layer;
+	scene.groups = &group;
+
+	for (size_t i = 0; i < 256; i++)
+	{
+		scene.palette.color[i].r = static_cast<uint8_t>(i * 37);
+		scene.palette.color[i].g = static_cast<uint8_t>(255 - i * 11);
+		scene.palette.color[i].b = static_cast<uint8_t>(i * 5);
+		scene.palette.color[i].a = 255;
+	}
+
+	ofstream out(file_name, ios_base::binary);
+
+	if (!ogt_vox_write_scene_to_stream(&scene, write_to_ofstream, &out))
+		return false;
+
+	out.close();
+
+	return !out.fail();
+}
+
+// Rays from a sphere around the model to random points of its voxel grid
+// box, in world space
+void get_test_rays(const voxel_object& v, const size_t count, vector<custom_math::vertex_3>& origins, vector<custom_math::vertex_3>& directions)
+{
+	std::mt19937 generator(1);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	const float radius = 2.0f * std::max(
+		glm::length(glm::vec3(v.vo_grid_min.x, v.vo_grid_min.y, v.vo_grid_min.z)),
+		glm::length(glm::vec3(v.vo_grid_max.x, v.vo_grid_max.y, v.vo_grid_max.z)));
+
+	origins.resize(count);
+	directions.resize(count);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		glm::vec3 o;
+
+		do
+			o = glm::vec3(2.0f * unit(generator) - 1.0f, 2.0f * unit(generator) - 1.0f, 2.0f * unit(generator) - 1.0f);
+		while (glm::length(o) < 0.1f || glm::length(o) > 1.0f);
+
+		o = glm::normalize(o) * radius;
+
+		const glm::vec4 target = v.model_matrix * glm::vec4(
+			v.vo_grid_min.x + unit(generator) * (v.vo_grid_max.x - v.vo_grid_min.x),
+			v.vo_grid_min.y + unit(generator) * (v.vo_grid_max.y - v.vo_grid_min.y),
+			v.vo_grid_min.z + unit(generator) * (v.vo_grid_max.z - v.vo_grid_min.z),
+			1.0f);
+
+		origins[i] = custom_math::vertex_3(o.x, o.y, o.z);
+		directions[i] = custom_math::vertex_3(target.x - o.x, target.y - o.y, target.z - o.z);
+	}
+}
+
+// Reference for voxel_object::find_voxel_on_ray: the ray is tested against
+// every occupied grid cell, in the same cell units, and the nearest hit kept
+bool find_voxel_on_ray_brute_force(
+	const voxel_object& v,
+	const vector<glm::ivec3>& cells,
+	const custom_math::vertex_3& ray_origin,
+	const custom_math::vertex_3& ray_direction,
+	size_t& voxel_index,
+	float& t)
+{
+	const glm::mat4 inv_model_matrix = glm::inverse(v.model_matrix);
+
+	const glm::vec4 local_origin = inv_model_matrix * glm::vec4(ray_origin.x, ray_origin.y, ray_origin.z, 1.0f);
+	const glm::vec4 local_direction = inv_model_matrix * glm::vec4(ray_direction.x, ray_direction.y, ray_direction.z, 0.0f);
+
+	const float origin[3] = {
+		(local_origin.x - v.vo_grid_min.x) / v.cell_size,
+		(local_origin.y - v.vo_grid_min.y) / v.cell_size,
+		(local_origin.z - v.vo_grid_min.z) / v.cell_size };
+
+	const float direction[3] = { local_direction.x / v.cell_size, local_direction.y / v.cell_size, local_direction.z / v.cell_size };
+
+	bool found = false;
+
+	for (size_t i = 0; i < cells.size(); i++)
+	{
+		float t_near = 0.0f;
+		float t_far = numeric_limits<float>::max();
+
+		for (int j = 0; j < 3 && t_near < t_far; j++)
+		{
+			const float lo = static_cast<float>(cells[i][j]);
+
+			if (direction[j] == 0.0f)
+			{
+				if (origin[j] < lo || origin[j] >= lo + 1.0f)
+					t_far = 0.0f;
+
+				continue;
+			}
+
+			float t0 = (lo - origin[j]) / direction[j];
+			float t1 = (lo + 1.0f - origin[j]) / direction[j];
+
+			if (t0 > t1)
+				std::swap(t0, t1);
+
+			t_near = std::max(t_near, t0);
+			t_far = std::min(t_far, t1);
+		}
+
+		if (t_near < t_far && (!found || t_near < t))
+		{
+			voxel_index = v.vo_grid_cells.get(cells[i].x, cells[i].y, cells[i].z);
+			t = t_near;
+			found = true;
+		}
+	}
+
+	return found;
+}
+
+// Compares find_voxel_on_ray with the brute force version over the first
+// rays, as many as keeps the check quick for the number of occupied cells.
+// Returns the number of rays that disagree. Two voxels hit at the same t
+// (at a shared face or edge) both count as right.
+size_t check_find_voxel_on_ray(const voxel_object& v, const vector<custom_math::vertex_3>& origins, const vector<custom_math::vertex_3>& directions, size_t& checked)
+{
+	vector<glm::ivec3> cells;
+
+	for (size_t z = 0; z < v.vo_grid_cells.z_res; z++)
+		for (size_t y = 0; y < v.vo_grid_cells.y_res; y++)
+			for (size_t x = 0; x < v.vo_grid_cells.x_res; x++)
+				if (v.vo_grid_cells.get(x, y, z) != -1)
+					cells.push_back(glm::ivec3(static_cast<int>(x), static_cast<int>(y), static_cast<int>(z)));
+
+	checked = std::min(origins.size(), std::max(size_t(16), (size_t(1) << 26) / std::max(size_t(1), cells.size())));
+
+	size_t mismatches = 0;
+
+	for (size_t i = 0; i < checked; i++)
+	{
+		size_t index = 0, reference_index = 0;
+		float t = 0, reference_t = 0;
+
+		const bool hit = v.find_voxel_on_ray(origins[i], directions[i], v.model_matrix, index, t);
+		const bool reference_hit = find_voxel_on_ray_brute_force(v, cells, origins[i], directions[i], reference_index, reference_t);
+
+		if (hit != reference_hit)
+			mismatches++;
+		else if (hit && index != reference_index && fabsf(t - reference_t) > 1e-5f * (1.0f + reference_t))
+			mismatches++;
+	}
+
+	return mismatches;
+}
+
+bool benchmark_file(const char* file_name, const size_t iterations)
+{
+	ifstream infile(file_name, ifstream::ate | ifstream::binary);
+
+	if (infile.fail())
+	{
+		cout << "Could not open file " << file_name << endl;
+		return false;
+	}
+
+	const double file_size = static_cast<double>(infile.tellg());
+	infile.close();
+
+	voxel_object v;
+	v.model_matrix = glm::rotate(glm::mat4(1.0f), 0.3f, glm::vec3(0.0f, 1.0f, 0.0f));
+	v.model_matrix = glm::rotate(v.model_matrix, 0.2f, glm::vec3(1.0f, 0.0f, 0.0f));
+
+	stage_timer load, scene_load, mesh, sample, blacken, pick, stl;
+
+	load.name = "get_voxels";
+	load.unit = "voxels";
+	load.run(iterations, [&]() { get_voxels(file_name, v); });
+
+	if (v.get_cell_count() == 0)
+	{
+		cout << "Could not load " << file_name << endl;
+		return false;
+	}
+
+	load.work_per_run = static_cast<double>(v.get_cell_count());
+
+	vector<voxel_object> instances;
+
+	scene_load.name = "get_voxel_scene";
+	scene_load.unit = "instances";
+	scene_load.run(iterations, [&]() { get_voxel_scene(file_name, instances); });
+	scene_load.work_per_run = static_cast<double>(instances.size());
+
+	// Bytes actually held by the scene, counting shared bricks once
+	size_t models = 0;
+	size_t scene_bytes = 0;
+
+	for (size_t i = 0; i < instances.size(); i++)
+	{
+		size_t j = 0;
+
+		while (j < i && false == instances[i].voxel_colours.shares_storage_with(instances[j].voxel_colours))
+			j++;
+
+		scene_bytes += instances[i].get_storage_bytes();
+
+		if (j == i)
+			models++;
+		else
+			scene_bytes -= instances[i].voxel_colours.get_storage_bytes() + instances[i].vo_grid_cells.get_storage_bytes();
+	}
+
+	mesh.name = greedy_meshing ? "get_triangles_greedy" : "get_triangles";
+	mesh.unit = "voxels";
+	mesh.work_per_run = static_cast<double>(v.get_cell_count());
+	mesh.run(iterations, [&]()
+		{
+			if (greedy_meshing)
+				get_triangles_greedy(v.mesh, v);
+			else
+				get_triangles(v.mesh, v);
+		});
+
+	sample.name = "get_background_points";
+	sample.unit = "samples";
+	sample.work_per_run = static_cast<double>(x_res * y_res * z_res);
+	sample.run(iterations, [&]() { get_background_points(v); });
+
+	// do_blackening darkens the voxel colours in place, which doesn't change its cost
+	blacken.name = "do_blackening";
+	blacken.unit = "samples";
+	blacken.work_per_run = static_cast<double>(v.background_surface_densities.count());
+	blacken.run(iterations, [&]() { do_blackening(v); });
+
+	vector<custom_math::vertex_3> ray_origins, ray_directions;
+	get_test_rays(v, 4096, ray_origins, ray_directions);
+
+	size_t ray_hits = 0;
+
+	pick.name = "find_voxel_on_ray";
+	pick.unit = "rays";
+	pick.work_per_run = static_cast<double>(ray_origins.size());
+	pick.run(iterations, [&]()
+		{
+			ray_hits = 0;
+
+			for (size_t i = 0; i < ray_origins.size(); i++)
+			{
+				size_t voxel_index = 0;
+				float t = 0;
+
+				if (v.find_voxel_on_ray(ray_origins[i], ray_directions[i], v.model_matrix, voxel_index, t))
+					ray_hits++;
+			}
+		});
+
+	size_t rays_checked = 0;
+	const size_t ray_mismatches = check_find_voxel_on_ray(v, ray_origins, ray_directions, rays_checked);
+
+	const string stl_file_name = string(file_name) + ".benchmark.stl";
+
+	stl.name = "write_triangles_to_stl";
+	stl.unit = "MB";
+	stl.work_per_run = (84.0 + 50.0 * v.mesh.size()) / 1048576.0;
+	stl.run(iterations, [&]() { write_triangles_to_binary_stereo_lithography_file(v.mesh, stl_file_name.c_str()); });
+
+	remove(stl_file_name.c_str());
+
+	cout << file_name << ": " << v.voxel_x_res << "x" << v.voxel_y_res << "x" << v.voxel_z_res
+		<< ", " << v.voxel_densities.count() << " solid voxels, " << v.mesh.size() << " triangles, "
+		<< v.background_surface_densities.count() << " surface samples, "
+		<< fixed << setprecision(1) << file_size / 1024.0 << " KB" << endl;
+
+	cout << "  voxel storage " << v.voxel_colours.brick_count() << " bricks, "
+		<< fixed << setprecision(1) << v.get_storage_bytes() / 1024.0 << " KB" << endl;
+
+	cout << "  scene " << instances.size() << " instances of " << models << " models, "
+		<< fixed << setprecision(1) << scene_bytes / 1024.0 << " KB" << endl;
+
+	cout << "  rays " << ray_hits << " of " << ray_origins.size() << " hit, "
+		<< ray_mismatches << " of " << rays_checked << " differ from brute force" << endl;
+
+	load.report();
+	scene_load.report();
+	mesh.report();
+	sample.report();
+	blacken.report();
+	pick.report();
+	stl.report();
+
+	cout << "  peak RSS so far " << fixed << setprecision(1) << get_peak_rss() / 1048576.0 << " MB" << endl;
+
+	return ray_mismatches == 0;
+}
+
+int main(int argc, char** argv)
+{
+	size_t iterations = 10;
+	vector<size_t> sizes;
+
+	// Same as the viewer
+	ogt_vox_set_arena_allocation(true);
+
+	vector<string> input_files;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const string arg = argv[i];
+
+		if (arg == "--iterations" && i + 1 < argc)
+			iterations = std::max(1, atoi(argv[++i]));
+		else if (arg == "--threads" && i + 1 < argc)
+		{
+			background_thread_count = std::max(1, atoi(argv[++i]));
+			ogt_vox_set_read_thread_count(static_cast<uint32_t>(background_thread_count));
+			ogt_vox_set_write_thread_count(static_cast<uint32_t>(background_thread_count));
+		}
+		else if (arg == "--greedy")
+			greedy_meshing = true;
+		else if (arg == "--rasterize")
+			rasterize_background = true;
+		else if (arg == "--sizes" && i + 1 < argc)
+		{
+			istringstream iss(argv[++i]);
+			string token;
+
+			while (getline(iss, token, ','))
+				if (atoi(token.c_str()) > 0)
+					sizes.push_back(std::min(256, atoi(token.c_str())));
+		}
+		else if (arg.size() > 1 && arg[0] == '-')
+		{
+			cout << "Usage: vox_benchmark [--iterations N] [--sizes N,N,...] [--threads N] [--greedy] [--rasterize] [file.vox ...]" << endl;
+			return 1;
+		}
+		else
+			input_files.push_back(arg);
+	}
+
+	if (input_files.empty())
+		input_files.push_back("chr_knight.vox");
+
+	get_test_texture();
+
+	cout << iterations << " iterations, " << background_thread_count << " background threads"
+		<< (rasterize_background ? ", rasterized background" : "") << endl;
+
+	bool ok = true;
+
+	for (size_t i = 0; i < input_files.size(); i++)
+		ok = benchmark_file(input_files[i].c_str(), iterations) && ok;
+
+	for (size_t i = 0; i < sizes.size(); i++)
+	{
+		const string file_name = "synthetic_" + to_string(sizes[i]) + ".vox";
+
+		if (!write_synthetic_model(sizes[i], file_name.c_str()))
+		{
+			cout << "Could not write " << file_name << endl;
+			ok = false;
+			continue;
+		}
+
+		ok = benchmark_file(file_name.c_str(), iterations) && ok;
+
+		remove(file_name.c_str());
+	}
+
+	return ok ? 0 : 1;
+}
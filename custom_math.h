@@ -31,22 +31,20 @@ using std::endl;
 namespace custom_math
 {
 
-	class vertex_3
+	// Position-only counterpart of vertex_3, for bulk arrays (voxel and lattice
+	// centres, triangle corners). It converts to and from vertex_3 implicitly.
+	class alignas(16) position_3
 	{
 	public:
-		inline vertex_3(void) : x(0.0f), y(0.0f), z(0.0f) { /*default constructor*/ }
-		inline vertex_3(const float src_x, const float src_y, const float src_z, const size_t src_index) : x(src_x), y(src_y), z(src_z) { /* custom constructor */ }
-		inline vertex_3(const float src_x, const float src_y, const float src_z) : x(src_x), y(src_y), z(src_z) { /* custom constructor */ }
+		constexpr position_3(void) : x(0.0f), y(0.0f), z(0.0f) { /*default constructor*/ }
+		constexpr position_3(const float src_x, const float src_y, const float src_z) : x(src_x), y(src_y), z(src_z) { /* custom constructor */ }
 
-		inline bool operator==(const vertex_3& right) const
+		constexpr bool operator==(const position_3& right) const
 		{
-			if (right.x == x && right.y == y && right.z == z)
-				return true;
-			else
-				return false;
+			return right.x == x && right.y == y && right.z == z;
 		}
 
-		inline bool operator<(const vertex_3& right) const
+		inline bool operator<(const position_3& right) const
 		{
 			if (right.x > x)
 				return true;
@@ -66,61 +64,145 @@ namespace custom_math
 			return false;
 		}
 
-		inline const vertex_3& operator-(const vertex_3& right) const
+		constexpr position_3 operator-(const position_3& right) const
 		{
-			static vertex_3 temp;
+			return position_3(x - right.x, y - right.y, z - right.z);
+		}
+
+		constexpr position_3 operator+(const position_3& right) const
+		{
+			return position_3(x + right.x, y + right.y, z + right.z);
+		}
 
-			temp.x = this->x - right.x;
-			temp.y = this->y - right.y;
-			temp.z = this->z - right.z;
+		constexpr position_3 operator*(const float& right) const
+		{
+			return position_3(x * right, y * right, z * right);
+		}
 
-			return temp;
+		constexpr position_3 cross(const position_3& right) const
+		{
+			return position_3(y * right.z - z * right.y, z * right.x - x * right.z, x * right.y - y * right.x);
 		}
 
-		inline const vertex_3& operator+(const vertex_3& right) const
+		constexpr float dot(const position_3& right) const
 		{
-			static vertex_3 temp;
+			return x * right.x + y * right.y + z * right.z;
+		}
 
-			temp.x = this->x + right.x;
-			temp.y = this->y + right.y;
-			temp.z = this->z + right.z;
+		constexpr float self_dot(void) const
+		{
+			return x * x + y * y + z * z;
+		}
 
-			return temp;
+		inline float length(void) const
+		{
+			return std::sqrt(self_dot());
 		}
 
-		inline const vertex_3& operator*(const float& right) const
+		inline void normalize(void)
 		{
-			static vertex_3 temp;
+			float len = length();
 
-			temp.x = this->x * right;
-			temp.y = this->y * right;
-			temp.z = this->z * right;
+			if (0.0f != len)
+			{
+				x /= len;
+				y /= len;
+				z /= len;
+			}
+		}
+
+		inline void rotate_x(const float& radians)
+		{
+			float t_y = y;
 
-			return temp;
+			y = t_y * cos(radians) + z * sin(radians);
+			z = t_y * -sin(radians) + z * cos(radians);
 		}
 
-		inline const vertex_3& cross(const vertex_3& right) const
+		inline void rotate_y(const float& radians)
 		{
-			static vertex_3 temp;
+			float t_x = x;
 
-			temp.x = y * right.z - z * right.y;
-			temp.y = z * right.x - x * right.z;
-			temp.z = x * right.y - y * right.x;
+			x = t_x * cos(radians) + z * -sin(radians);
+			z = t_x * sin(radians) + z * cos(radians);
+		}
+
+		float x, y, z;
+	};
 
-			return temp;
+	class vertex_3
+	{
+	public:
+		constexpr vertex_3(void) : x(0.0f), y(0.0f), z(0.0f) { /*default constructor*/ }
+		constexpr vertex_3(const float src_x, const float src_y, const float src_z, const size_t src_index) : x(src_x), y(src_y), z(src_z) { /* custom constructor */ }
+		constexpr vertex_3(const float src_x, const float src_y, const float src_z) : x(src_x), y(src_y), z(src_z) { /* custom constructor */ }
+		constexpr vertex_3(const position_3& src) : x(src.x), y(src.y), z(src.z) { /* conversion constructor */ }
+
+		constexpr operator position_3(void) const
+		{
+			return position_3(x, y, z);
+		}
+
+		inline bool operator==(const vertex_3& right) const
+		{
+			if (right.x == x && right.y == y && right.z == z)
+				return true;
+			else
+				return false;
+		}
+
+		inline bool operator<(const vertex_3& right) const
+		{
+			if (right.x > x)
+				return true;
+			else if (right.x < x)
+				return false;
+
+			if (right.y > y)
+				return true;
+			else if (right.y < y)
+				return false;
+
+			if (right.z > z)
+				return true;
+			else if (right.z < z)
+				return false;
+
+			return false;
+		}
+
+		// These return by value, so they are safe to use from several threads at once
+		constexpr vertex_3 operator-(const vertex_3& right) const
+		{
+			return vertex_3(x - right.x, y - right.y, z - right.z);
+		}
+
+		constexpr vertex_3 operator+(const vertex_3& right) const
+		{
+			return vertex_3(x + right.x, y + right.y, z + right.z);
+		}
+
+		constexpr vertex_3 operator*(const float& right) const
+		{
+			return vertex_3(x * right, y * right, z * right);
+		}
+
+		constexpr vertex_3 cross(const vertex_3& right) const
+		{
+			return vertex_3(y * right.z - z * right.y, z * right.x - x * right.z, x * right.y - y * right.x);
 		}
 
-		inline float dot(const vertex_3& right) const
+		constexpr float dot(const vertex_3& right) const
 		{
 			return x * right.x + y * right.y + z * right.z;
 		}
 
-		inline const float self_dot(void)
+		constexpr float self_dot(void) const
 		{
 			return x * x + y * y + z * z;
 		}
 
-		inline const float length(void)
+		inline float length(void) const
 		{
 			return std::sqrt(self_dot());
 		}
@@ -162,7 +244,7 @@ namespace custom_math
 		float x = 0, y = 0, z = 0;
 		float u = 0, v = 0;
 		float nx = 0, ny = 0, nz = 0;
-		size_t index;
+		size_t index = 0;
 	};
 
 
@@ -173,7 +255,7 @@ namespace custom_math
 	class triangle
 	{
 	public:
-		vertex_3 vertex[3];
+		position_3 vertex[3];
 		vertex_3 colour;
 	};
 
@@ -182,12 +264,12 @@ namespace custom_math
 	class quad
 	{
 	public:
-		vertex_3 vertex[4];
+		position_3 vertex[4];
 		vertex_3 colour;
 	
-		std::vector<vertex_3> get_normalized() const {
-			std::vector<vertex_3> sorted_vertices = { vertex[0], vertex[1], vertex[2], vertex[3]};
-			std::sort(sorted_vertices.begin(), sorted_vertices.end(), [](const vertex_3& a, const vertex_3& b) {
+		std::vector<position_3> get_normalized() const {
+			std::vector<position_3> sorted_vertices = { vertex[0], vertex[1], vertex[2], vertex[3]};
+			std::sort(sorted_vertices.begin(), sorted_vertices.end(), [](const position_3& a, const position_3& b) {
 				return std::tie(a.x, a.y, a.z) < std::tie(b.x, b.y, b.z);
 				});
 			return sorted_vertices;
@@ -35,54 +35,74 @@ void main() {
 }
 )";
 
-void draw_triangles(const std::vector<custom_math::vertex_3>& positions, const std::vector<custom_math::vertex_3>& colors, glm::mat4 model) {
-    if (positions.empty() || colors.empty() || positions.size() != colors.size()) {
-        return;
-    }
+// Retained renderer state. The shader program is compiled once and its
+// uniform locations are cached; geometry lives in persistent buffers that
+// are only re-uploaded when the data behind them changes.
+GLuint common_shader_program = 0;
+GLint common_model_loc = -1;
+GLint common_view_loc = -1;
+GLint common_projection_loc = -1;
+
+struct gpu_buffer {
+    GLuint vao = 0;
+    GLuint vbo = 0;
+    GLuint ebo = 0;
+    GLsizei count = 0; // Number of indices if ebo != 0, otherwise number of vertices
+};
 
-    // Calculate triangle indices
-    std::vector<GLuint> indices;
-    for (size_t i = 0; i < positions.size(); i += 3) {
-        if (i + 2 < positions.size()) {
-            indices.push_back(static_cast<GLuint>(i));
-            indices.push_back(static_cast<GLuint>(i + 1));
-            indices.push_back(static_cast<GLuint>(i + 2));
+gpu_buffer triangle_buffer;      // vo.mesh
+gpu_buffer surface_point_buffer; // The set points of vo.background_surface_densities
+gpu_buffer axis_buffer;
+gpu_buffer scratch_buffer;       // Used by the immediate draw_* helpers
+
+bool use_common_shader(const glm::mat4& model) {
+    if (common_shader_program == 0) {
+        common_shader_program = createShaderProgram(commonVertexShaderSource, commonFragmentShaderSource);
+
+        if (common_shader_program == 0) {
+            return false;
         }
+
+        common_model_loc = glGetUniformLocation(common_shader_program, "model");
+        common_view_loc = glGetUniformLocation(common_shader_program, "view");
+        common_projection_loc = glGetUniformLocation(common_shader_program, "projection");
     }
 
-    // Create vertex data
-    std::vector<RenderVertex> vertices;
-    for (size_t i = 0; i < positions.size(); ++i) {
-        RenderVertex vertex;
-        vertex.position[0] = positions[i].x;
-        vertex.position[1] = positions[i].y;
-        vertex.position[2] = positions[i].z;
-        vertex.color[0] = colors[i].x;
-        vertex.color[1] = colors[i].y;
-        vertex.color[2] = colors[i].z;
-        vertices.push_back(vertex);
-    }
-
-    // Create shader program
-    GLuint shaderProgram = createShaderProgram(commonVertexShaderSource, commonFragmentShaderSource);
-    if (shaderProgram == 0) {
-        return;
+    glUseProgram(common_shader_program);
+
+    glUniformMatrix4fv(common_model_loc, 1, GL_FALSE, glm::value_ptr(model));
+    glUniformMatrix4fv(common_view_loc, 1, GL_FALSE, glm::value_ptr(main_camera.view_mat));
+    glUniformMatrix4fv(common_projection_loc, 1, GL_FALSE, glm::value_ptr(main_camera.projection_mat));
+
+    return true;
+}
+
+// Creates the buffer objects on first use, then replaces their contents.
+// Pass num_indices = 0 for non-indexed geometry.
+void upload_buffer(gpu_buffer& buffer, const RenderVertex* vertices, const size_t num_vertices, const GLuint* indices, const size_t num_indices) {
+    if (buffer.vao == 0) {
+        glGenVertexArrays(1, &buffer.vao);
+        glGenBuffers(1, &buffer.vbo);
     }
 
-    // Create and bind VAO
-    GLuint vao, vbo, ebo;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+    glBindVertexArray(buffer.vao);
 
-    // Create and bind VBO
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(RenderVertex), vertices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer.vbo);
+    glBufferData(GL_ARRAY_BUFFER, num_vertices * sizeof(RenderVertex), vertices, GL_DYNAMIC_DRAW);
 
-    // Create and bind EBO
-    glGenBuffers(1, &ebo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+    if (num_indices > 0) {
+        if (buffer.ebo == 0) {
+            glGenBuffers(1, &buffer.ebo);
+        }
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer.ebo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, num_indices * sizeof(GLuint), indices, GL_DYNAMIC_DRAW);
+    }
+    else if (buffer.ebo != 0) {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        glDeleteBuffers(1, &buffer.ebo);
+        buffer.ebo = 0;
+    }
 
     // Set vertex attribute pointers
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(RenderVertex), (void*)0);
@@ -90,154 +110,98 @@ void draw_triangles(const std::vector<custom_math::vertex_3>& positions, const s
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(RenderVertex), (void*)(3 * sizeof(float)));
     glEnableVertexAttribArray(1);
 
-    // Use shader program
-    glUseProgram(shaderProgram);
+    glBindVertexArray(0);
 
-    // Set uniform matrices
-    GLint modelLoc = glGetUniformLocation(shaderProgram, "model");
-    GLint viewLoc = glGetUniformLocation(shaderProgram, "view");
-    GLint projLoc = glGetUniformLocation(shaderProgram, "projection");
+    buffer.count = static_cast<GLsizei>(num_indices > 0 ? num_indices : num_vertices);
+}
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(main_camera.view_mat));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(main_camera.projection_mat));
+void upload_buffer(gpu_buffer& buffer, const std::vector<custom_math::vertex_3>& positions, const std::vector<custom_math::vertex_3>& colors) {
+    std::vector<RenderVertex> vertices(positions.size());
 
-    // Draw triangles
-    glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(indices.size()), GL_UNSIGNED_INT, 0);
+    for (size_t i = 0; i < positions.size(); ++i) {
+        vertices[i].position[0] = positions[i].x;
+        vertices[i].position[1] = positions[i].y;
+        vertices[i].position[2] = positions[i].z;
+        vertices[i].color[0] = colors[i].x;
+        vertices[i].color[1] = colors[i].y;
+        vertices[i].color[2] = colors[i].z;
+    }
 
-    // Cleanup
-    glBindVertexArray(0);
-    glDeleteBuffers(1, &vbo);
-    glDeleteBuffers(1, &ebo);
-    glDeleteVertexArrays(1, &vao);
-    glDeleteProgram(shaderProgram);
+    upload_buffer(buffer, vertices.data(), vertices.size(), nullptr, 0);
 }
 
-void draw_lines(const std::vector<custom_math::vertex_3>& positions, const std::vector<custom_math::vertex_3>& colors, glm::mat4 model) {
-    if (positions.empty() || colors.empty() || positions.size() != colors.size()) {
-        return;
-    }
+void upload_buffer(gpu_buffer& buffer, const indexed_mesh& mesh) {
+    static_assert(sizeof(Vertex) == sizeof(RenderVertex), "Vertex layout must match RenderVertex");
 
-    // Create vertex data
-    std::vector<RenderVertex> vertices;
-    for (size_t i = 0; i < positions.size(); ++i) {
-        RenderVertex vertex;
-        vertex.position[0] = positions[i].x;
-        vertex.position[1] = positions[i].y;
-        vertex.position[2] = positions[i].z;
-        vertex.color[0] = colors[i].x;
-        vertex.color[1] = colors[i].y;
-        vertex.color[2] = colors[i].z;
-        vertices.push_back(vertex);
-    }
-
-    // Create shader program
-    GLuint shaderProgram = createShaderProgram(commonVertexShaderSource, commonFragmentShaderSource);
-    if (shaderProgram == 0) {
+    upload_buffer(buffer, reinterpret_cast<const RenderVertex*>(mesh.vertices.data()), mesh.vertices.size(), mesh.indices.data(), mesh.indices.size());
+}
+
+void draw_buffer(const gpu_buffer& buffer, const GLenum mode, const glm::mat4& model) {
+    if (buffer.vao == 0 || buffer.count == 0 || !use_common_shader(model)) {
         return;
     }
 
-    // Create and bind VAO
-    GLuint vao, vbo;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+    glBindVertexArray(buffer.vao);
 
-    // Create and bind VBO
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(RenderVertex), vertices.data(), GL_STATIC_DRAW);
+    if (buffer.ebo != 0)
+        glDrawElements(mode, buffer.count, GL_UNSIGNED_INT, 0);
+    else
+        glDrawArrays(mode, 0, buffer.count);
 
-    // Set vertex attribute pointers
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(RenderVertex), (void*)0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(RenderVertex), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
+    glBindVertexArray(0);
+}
 
-    // Use shader program
-    glUseProgram(shaderProgram);
+void release_buffer(gpu_buffer& buffer) {
+    if (buffer.ebo != 0)
+        glDeleteBuffers(1, &buffer.ebo);
 
-    // Set uniform matrices
-    GLint modelLoc = glGetUniformLocation(shaderProgram, "model");
-    GLint viewLoc = glGetUniformLocation(shaderProgram, "view");
-    GLint projLoc = glGetUniformLocation(shaderProgram, "projection");
-    //glm::mat4 model = glm::mat4(1.0f);
-    //model = glm::rotate(model, u, glm::vec3(0.0f, 1.0f, 0.0f));
-    //model = glm::rotate(model, v, glm::vec3(1.0f, 0.0f, 0.0f));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(main_camera.view_mat));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(main_camera.projection_mat));
+    if (buffer.vbo != 0)
+        glDeleteBuffers(1, &buffer.vbo);
 
-    // Draw lines
-    glDrawArrays(GL_LINES, 0, static_cast<GLsizei>(vertices.size()));
+    if (buffer.vao != 0)
+        glDeleteVertexArrays(1, &buffer.vao);
 
-    // Cleanup
-    glBindVertexArray(0);
-    glDeleteBuffers(1, &vbo);
-    glDeleteVertexArrays(1, &vao);
-    glDeleteProgram(shaderProgram);
+    buffer = gpu_buffer();
 }
 
-void draw_points(const std::vector<custom_math::vertex_3>& positions, const std::vector<custom_math::vertex_3>& colors, glm::mat4 model) {
+// Immediate helpers for one-off geometry; these go through scratch_buffer
+void draw_triangles(const std::vector<custom_math::vertex_3>& positions, const std::vector<custom_math::vertex_3>& colors, glm::mat4 model) {
     if (positions.empty() || colors.empty() || positions.size() != colors.size()) {
         return;
     }
 
-    // Create vertex data
-    std::vector<RenderVertex> vertices;
-    for (size_t i = 0; i < positions.size(); ++i) {
-        RenderVertex vertex;
-        vertex.position[0] = positions[i].x;
-        vertex.position[1] = positions[i].y;
-        vertex.position[2] = positions[i].z;
-        vertex.color[0] = colors[i].x;
-        vertex.color[1] = colors[i].y;
-        vertex.color[2] = colors[i].z;
-        vertices.push_back(vertex);
-    }
-
-    // Create shader program
-    GLuint shaderProgram = createShaderProgram(commonVertexShaderSource, commonFragmentShaderSource);
-    if (shaderProgram == 0) {
-        return;
-    }
+    upload_buffer(scratch_buffer, positions, colors);
+    draw_buffer(scratch_buffer, GL_TRIANGLES, model);
+}
 
-    // Create and bind VAO
-    GLuint vao, vbo;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+// Draws a welded mesh, re-uploading it only if it has changed since the last draw
+void draw_triangles(indexed_mesh& mesh, glm::mat4 model) {
+    if (mesh.dirty) {
+        upload_buffer(triangle_buffer, mesh);
+        mesh.dirty = false;
+    }
 
-    // Create and bind VBO
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(RenderVertex), vertices.data(), GL_STATIC_DRAW);
+    draw_buffer(triangle_buffer, GL_TRIANGLES, model);
+}
 
-    // Set vertex attribute pointers
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(RenderVertex), (void*)0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(RenderVertex), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
+void draw_lines(const std::vector<custom_math::vertex_3>& positions, const std::vector<custom_math::vertex_3>& colors, glm::mat4 model) {
+    if (positions.empty() || colors.empty() || positions.size() != colors.size()) {
+        return;
+    }
 
-    // Use shader program
-    glUseProgram(shaderProgram);
+    upload_buffer(scratch_buffer, positions, colors);
+    draw_buffer(scratch_buffer, GL_LINES, model);
+}
 
-    // Set uniform matrices
-    GLint modelLoc = glGetUniformLocation(shaderProgram, "model");
-    GLint viewLoc = glGetUniformLocation(shaderProgram, "view");
-    GLint projLoc = glGetUniformLocation(shaderProgram, "projection");
+void draw_points(const std::vector<custom_math::vertex_3>& positions, const std::vector<custom_math::vertex_3>& colors, glm::mat4 model) {
+    if (positions.empty() || colors.empty() || positions.size() != colors.size()) {
+        return;
+    }
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(main_camera.view_mat));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(main_camera.projection_mat));
+    upload_buffer(scratch_buffer, positions, colors);
 
-    // Draw points
     glPointSize(5.0f); // Optional: set point size
-    glDrawArrays(GL_POINTS, 0, static_cast<GLsizei>(vertices.size()));
-
-    // Cleanup
-    glBindVertexArray(0);
-    glDeleteBuffers(1, &vbo);
-    glDeleteVertexArrays(1, &vao);
-    glDeleteProgram(shaderProgram);
+    draw_buffer(scratch_buffer, GL_POINTS, model);
 }
 
 bool screenshot_mode = false;
@@ -342,42 +306,148 @@ void take_screenshot(size_t num_cams_wide, const char* filename, const bool reve
     out.write(reinterpret_cast<char*>(&pixel_data[0]), num_bytes);
 }
 
-int main(int argc, char** argv)
+void print_batch_usage(void)
 {
+    cout << "Usage: vox_view --batch [options] file.vox [file.vox ...]" << endl;
+    cout << "  --out-dir DIR   write the .stl files to DIR instead of next to the inputs" << endl;
+    cout << "  --greedy        use the greedy mesher" << endl;
+    cout << "  --rasterize     fill the background lattice by rasterizing the voxels" << endl;
+    cout << "  --blacken       apply do_blackening before meshing" << endl;
+    cout << "  --rotate U V    model rotation in radians about y (U) then x (V)" << endl;
+    cout << "  --threads N     threads used by get_background_points and the .vox reader" << endl;
+}
 
+// Headless mode: load -> sample -> (blacken) -> mesh -> export for each input,
+// without initializing GLUT, GLEW or a GL context
+int run_batch(int argc, char** argv)
+{
+    string out_dir;
+    bool blacken = false;
+    vector<string> input_files;
 
-    glutInit(&argc, argv);
-    init_opengl(win_x, win_y);
+    for (int i = 2; i < argc; i++)
+    {
+        const string arg = argv[i];
+
+        if (arg == "--out-dir" && i + 1 < argc)
+            out_dir = argv[++i];
+        else if (arg == "--greedy")
+            greedy_meshing = true;
+        else if (arg == "--rasterize")
+            rasterize_background = true;
+        else if (arg == "--blacken")
+            blacken = true;
+        else if (arg == "--rotate" && i + 2 < argc)
+        {
+            vo.u = static_cast<float>(atof(argv[++i]));
+            vo.v = static_cast<float>(atof(argv[++i]));
+        }
+        else if (arg == "--threads" && i + 1 < argc)
+        {
+            background_thread_count = std::max(1, atoi(argv[++i]));
+            ogt_vox_set_read_thread_count(static_cast<uint32_t>(background_thread_count));
+            ogt_vox_set_write_thread_count(static_cast<uint32_t>(background_thread_count));
+        }
+        else if (arg.size() > 1 && arg[0] == '-')
+        {
+            cout << "Unknown option " << arg << endl;
+            print_batch_usage();
+            return 1;
+        }
+        else
+            input_files.push_back(arg);
+    }
 
-    // Initialize GLEW after GLUT and context creation
-    GLenum err = glewInit();
-    if (GLEW_OK != err) {
-        cerr << "Error: " << glewGetErrorString(err) << endl;
+    if (input_files.empty())
+    {
+        print_batch_usage();
         return 1;
     }
 
+    if (blacken)
+        get_test_texture();
 
-    test_texture.resize(x_res * y_res * z_res, 0); // initialize to black
+    size_t num_failed = 0;
 
-    for (size_t x = 0; x < x_res; x++)
+    for (size_t i = 0; i < input_files.size(); i++)
     {
-        for (size_t y = 0; y < y_res; y++)
+        // Replace the extension with .stl, and the directory with out_dir if given
+        string out_file = input_files[i];
+
+        const size_t dot = out_file.find_last_of('.');
+        const size_t slash = out_file.find_last_of("/\\");
+
+        if (dot != string::npos && (slash == string::npos || dot > slash))
+            out_file = out_file.substr(0, dot);
+
+        if (out_dir != "")
+            out_file = out_dir + "/" + (slash == string::npos ? out_file : out_file.substr(slash + 1));
+
+        out_file += ".stl";
+
+        vo.model_matrix = glm::mat4(1.0f);
+        vo.model_matrix = glm::rotate(vo.model_matrix, vo.u, glm::vec3(0.0f, 1.0f, 0.0f));
+        vo.model_matrix = glm::rotate(vo.model_matrix, vo.v, glm::vec3(1.0f, 0.0f, 0.0f));
+
+        if (false == get_voxels(input_files[i].c_str(), vo))
         {
-            for (size_t z = 0; z < z_res; z++)
-            {
-                const size_t voxel_index = x + y * x_res + z * x_res * y_res;
+            num_failed++;
+            continue;
+        }
 
-                if (y >= y_res / 2)
-                    test_texture[voxel_index] = 255;
-            }
+        get_background_points(vo);
+
+        if (blacken)
+            do_blackening(vo);
+
+        if (greedy_meshing)
+            get_triangles_greedy(vo.mesh, vo);
+        else
+            get_triangles(vo.mesh, vo);
+
+        if (false == write_triangles_to_binary_stereo_lithography_file(vo.mesh, out_file.c_str()))
+        {
+            cout << "Could not write " << out_file << endl;
+            num_failed++;
         }
     }
 
+    cout << input_files.size() - num_failed << " of " << input_files.size() << " files processed" << endl;
+
+    return num_failed == 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+    // Every scene is destroyed as soon as its models are copied out, so let
+    // the reader put each one in a single block
+    ogt_vox_set_arena_allocation(true);
+
+    if (argc > 1 && string(argv[1]) == "--batch")
+        return run_batch(argc, argv);
+
+    glutInit(&argc, argv);
+    init_opengl(win_x, win_y);
+
+    // Initialize GLEW after GLUT and context creation
+    GLenum err = glewInit();
+    if (GLEW_OK != err) {
+        cerr << "Error: " << glewGetErrorString(err) << endl;
+        return 1;
+    }
+
+    get_test_texture();
+
 
     vo.model_matrix = glm::mat4(1.0f);
     get_voxels("chr_knight.vox", vo);
 //    do_blackening(vo);
-    get_triangles(vo.tri_vec, vo);
+
+    if (greedy_meshing)
+        get_triangles_greedy(vo.mesh, vo);
+    else
+        get_triangles(vo.mesh, vo);
+
     get_background_points(vo);
 
 
@@ -493,19 +563,24 @@ void draw_objects(void)
 
 
 
-    positions.clear();
-    colors.clear();
-
-    for (size_t i = 0; i < vo.background_surface_centres.size(); i++)
+    // The surface points only need uploading after get_background_points
+    if (vo.background_dirty)
     {
-        if (vo.background_surface_densities[i] > 0)
-        {
-            positions.push_back(vo.background_surface_centres[i]);
-            colors.push_back(custom_math::vertex_3(0, 1, 1)); // Use a distinct color like cyan
-        }
+        positions.clear();
+        colors.clear();
+
+        vo.background_surface_densities.for_each_set([&](const size_t x, const size_t y, const size_t z)
+            {
+                positions.push_back(vo.background_lattice.centre(x, y, z));
+                colors.push_back(custom_math::vertex_3(0, 1, 1)); // Use a distinct color like cyan
+            });
+
+        upload_buffer(surface_point_buffer, positions, colors);
+        vo.background_dirty = false;
     }
 
-    draw_points(positions, colors, glm::mat4(1.0f));
+    glPointSize(5.0f);
+    draw_buffer(surface_point_buffer, GL_POINTS, glm::mat4(1.0f));
 
 
 
@@ -516,29 +591,17 @@ void draw_objects(void)
 
 	if (draw_triangles_on_screen)
 	{
-		positions.clear();
-		colors.clear();
-
-		for (const auto& tri : vo.tri_vec)
-		{
-			for (size_t j = 0; j < 3; ++j)
-			{
-				positions.push_back(tri.vertex[j]);
-				colors.push_back(tri.colour);
-			}
-		}
-
 		//glm::mat4 model = glm::mat4(1.0f);
 		//model = glm::rotate(model, u, glm::vec3(0.0f, 1.0f, 0.0f));
 		//model = glm::rotate(model, v, glm::vec3(1.0f, 0.0f, 0.0f));
 
 		// Draw triangles
-		draw_triangles(positions, colors, vo.model_matrix);
+		draw_triangles(vo.mesh, vo.model_matrix);
 	}
 
 
     // Optionally draw axes as lines
-    if (draw_axis) {
+    if (draw_axis && axis_buffer.vao == 0) {
         std::vector<custom_math::vertex_3> axis_positions = {
             {0.0f, 0.0f, 0.0f}, {10.0f, 0.0f, 0.0f},  // x-axis
             {0.0f, 0.0f, 0.0f}, {0.0f, 10.0f, 0.0f},  // y-axis
@@ -556,8 +619,11 @@ void draw_objects(void)
             {0.5f, 0.5f, 0.5f}, {0.5f, 0.5f, 0.5f}  // -z-axis (gray)
         };
 
-        draw_lines(axis_positions, axis_colors, glm::mat4(1.0f));
+        upload_buffer(axis_buffer, axis_positions, axis_colors);
     }
+
+    if (draw_axis)
+        draw_buffer(axis_buffer, GL_LINES, glm::mat4(1.0f));
 }
 
 
@@ -593,6 +659,27 @@ void keyboard_func(unsigned char key, int x, int y)
         break;
     }
 
+    case 'g':
+    {
+        greedy_meshing = !greedy_meshing;
+
+        if (greedy_meshing)
+            get_triangles_greedy(vo.mesh, vo);
+        else
+            get_triangles(vo.mesh, vo);
+
+        break;
+    }
+
+    case 'r':
+    {
+        rasterize_background = !rasterize_background;
+
+        get_background_points(vo);
+
+        break;
+    }
+
     case 'w':
     {
         draw_axis = !draw_axis;
@@ -614,9 +701,7 @@ void keyboard_func(unsigned char key, int x, int y)
 
 		std::chrono::high_resolution_clock::time_point global_time_start = std::chrono::high_resolution_clock::now();
 
-        get_background_points(vo);
-
-      //  get_triangles(vo.tri_vec, vo);
+        update_background_points(vo);
 
         std::chrono::high_resolution_clock::time_point global_time_end = std::chrono::high_resolution_clock::now();
         std::chrono::duration<float, std::milli> elapsed = global_time_end - global_time_start;
@@ -636,9 +721,7 @@ void keyboard_func(unsigned char key, int x, int y)
         std::chrono::high_resolution_clock::time_point global_time_start = std::chrono::high_resolution_clock::now();
 
        
-        get_background_points(vo);
-
-       // get_triangles(vo.tri_vec, vo);
+        update_background_points(vo);
 
         std::chrono::high_resolution_clock::time_point global_time_end = std::chrono::high_resolution_clock::now();
         std::chrono::duration<float, std::milli> elapsed = global_time_end - global_time_start;
@@ -657,9 +740,7 @@ void keyboard_func(unsigned char key, int x, int y)
         std::chrono::high_resolution_clock::time_point global_time_start = std::chrono::high_resolution_clock::now();
 
      
-        get_background_points(vo);
-
-       // get_triangles(vo.tri_vec, vo);
+        update_background_points(vo);
 
         std::chrono::high_resolution_clock::time_point global_time_end = std::chrono::high_resolution_clock::now();
         std::chrono::duration<float, std::milli> elapsed = global_time_end - global_time_start;
@@ -677,9 +758,7 @@ void keyboard_func(unsigned char key, int x, int y)
 
         std::chrono::high_resolution_clock::time_point global_time_start = std::chrono::high_resolution_clock::now();
 
-        get_background_points(vo);
-
-//        get_triangles(vo.tri_vec, vo);
+        update_background_points(vo);
 
         std::chrono::high_resolution_clock::time_point global_time_end = std::chrono::high_resolution_clock::now();
         std::chrono::duration<float, std::milli> elapsed = global_time_end - global_time_start;
@@ -753,10 +832,15 @@ void passive_motion_func(int x, int y)
 
 void cleanup(void)
 {
+    release_buffer(triangle_buffer);
+    release_buffer(surface_point_buffer);
+    release_buffer(axis_buffer);
+    release_buffer(scratch_buffer);
 
+    if (common_shader_program != 0)
+        glDeleteProgram(common_shader_program);
 
-
-
+    common_shader_program = 0;
 
     glutDestroyWindow(win_id);
 }
\ No newline at end of file
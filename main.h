@@ -26,197 +26,1863 @@
 #include <map>
 #include <utility>
 #include <ios>
+#include <cstring>
 #include <chrono>
+#include <thread>
+#include <atomic>
+#include <unordered_map>
+#include <memory>
+#include <cstdint>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 using namespace std;
 
 
 
-// OpenGL 4 additions
-struct Vertex {
-	float position[3];
-	float color[3];
-};
+// OpenGL 4 additions
+struct Vertex {
+	float position[3];
+	float color[3];
+};
+
+// Triangle mesh with a shared vertex array and an index buffer.
+// Corners with the same position and colour are welded into one vertex,
+// and the vertices are laid out as the renderer wants them, so the same
+// arrays are used for drawing and for export.
+// It has the same clear/push_back/size interface as vector<triangle>, so
+// the meshers can write to either.
+class indexed_mesh
+{
+public:
+	vector<Vertex> vertices;
+	vector<uint32_t> indices;
+
+	// Set whenever the mesh changes; cleared by the renderer once uploaded
+	bool dirty = true;
+
+	void clear(void)
+	{
+		vertices.clear();
+		indices.clear();
+		weld_map.clear();
+		dirty = true;
+	}
+
+	// Number of triangles
+	size_t size(void) const
+	{
+		return indices.size() / 3;
+	}
+
+	void push_back(const custom_math::triangle& t)
+	{
+		dirty = true;
+
+		for (size_t j = 0; j < 3; j++)
+			indices.push_back(add_vertex(t.vertex[j], t.colour));
+	}
+
+	// Called once the mesh is complete; this also drops the welding table
+	void shrink_to_fit(void)
+	{
+		vertices.shrink_to_fit();
+		indices.shrink_to_fit();
+		std::unordered_map<vertex_key, uint32_t, vertex_key_hash>().swap(weld_map);
+	}
+
+private:
+	struct vertex_key
+	{
+		float f[6];
+
+		bool operator==(const vertex_key& right) const
+		{
+			return memcmp(f, right.f, sizeof(f)) == 0;
+		}
+	};
+
+	struct vertex_key_hash
+	{
+		size_t operator()(const vertex_key& k) const
+		{
+			uint32_t bits[6];
+			memcpy(bits, k.f, sizeof(bits));
+
+			size_t h = 0;
+
+			for (size_t i = 0; i < 6; i++)
+				h = (h ^ bits[i]) * 1099511628211ull;
+
+			return h;
+		}
+	};
+
+	std::unordered_map<vertex_key, uint32_t, vertex_key_hash> weld_map;
+
+	uint32_t add_vertex(const custom_math::position_3& position, const custom_math::vertex_3& colour)
+	{
+		vertex_key k;
+		k.f[0] = position.x;
+		k.f[1] = position.y;
+		k.f[2] = position.z;
+		k.f[3] = colour.x;
+		k.f[4] = colour.y;
+		k.f[5] = colour.z;
+
+		const auto found = weld_map.find(k);
+
+		if (found != weld_map.end())
+			return found->second;
+
+		const uint32_t index = static_cast<uint32_t>(vertices.size());
+
+		Vertex vertex;
+		memcpy(vertex.position, &k.f[0], sizeof(vertex.position));
+		memcpy(vertex.color, &k.f[3], sizeof(vertex.color));
+		vertices.push_back(vertex);
+
+		weld_map[k] = index;
+
+		return index;
+	}
+};
+
+// Function prototypes
+void idle_func(void);
+void init_opengl(const int& width, const int& height);
+void reshape_func(int width, int height);
+void display_func(void);
+void keyboard_func(unsigned char key, int x, int y);
+void mouse_func(int button, int state, int x, int y);
+void motion_func(int x, int y);
+void passive_motion_func(int x, int y);
+
+void draw_objects(void);
+void cleanup(void);
+
+
+// Global variables
+custom_math::vector_3 background_colour(0.5f, 0.5f, 0.5f);
+custom_math::vector_3 control_list_colour(1.0f, 1.0f, 1.0f);
+
+bool draw_axis = true;
+bool draw_control_list = true;
+bool draw_triangles_on_screen = true;
+bool greedy_meshing = false; // use get_triangles_greedy instead of get_triangles
+uv_camera main_camera;
+
+GLint win_id = 0;
+GLint win_x = 800, win_y = 600;
+float camera_w = 10;
+
+float camera_fov = 45;
+float camera_x_transform = 0;
+float camera_y_transform = 0;
+float u_spacer = 0.01f;
+float v_spacer = 0.5f * u_spacer;
+float w_spacer = 0.1f;
+float camera_near = 0.01f;
+float camera_far = 100.0f;
+
+bool lmb_down = false;
+bool mmb_down = false;
+bool rmb_down = false;
+int mouse_x = 0;
+int mouse_y = 0;
+
+
+vector<unsigned char> test_texture;
+
+const size_t x_res = 250;
+const size_t y_res = 250;
+const size_t z_res = 250;
+
+const float x_grid_max = 10;
+const float y_grid_max = 10;
+const float z_grid_max = 10;
+
+// Number of threads used by get_background_points (1 = single-threaded)
+size_t background_thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+// Fill the background lattice by rasterizing each solid voxel into it,
+// instead of testing every lattice point against the voxel grid
+bool rasterize_background = false;
+
+
+
+
+// Index of the lowest set bit (x must not be 0)
+inline unsigned int count_trailing_zeros(const uint64_t x)
+{
+#ifdef _MSC_VER
+	unsigned long i = 0;
+	_BitScanForward64(&i, x);
+	return static_cast<unsigned int>(i);
+#else
+	return static_cast<unsigned int>(__builtin_ctzll(x));
+#endif
+}
+
+inline unsigned int count_set_bits(const uint64_t x)
+{
+#ifdef _MSC_VER
+	return static_cast<unsigned int>(__popcnt64(x));
+#else
+	return static_cast<unsigned int>(__builtin_popcountll(x));
+#endif
+}
+
+
+// Bit-packed 3D occupancy grid, 64 cells per word.
+// Each (y, z) row of cells along x starts on a fresh word, and the padding
+// bits past x_res are always kept clear. This way whole rows can be shifted
+// and OR'd together, and threads that work on different rows never share
+// a word.
+class occupancy_grid
+{
+public:
+	size_t x_res = 0;
+	size_t y_res = 0;
+	size_t z_res = 0;
+	size_t words_per_row = 0;
+	vector<uint64_t> words;
+
+	// Resize, and clear all of the cells
+	void resize(const size_t src_x_res, const size_t src_y_res, const size_t src_z_res)
+	{
+		x_res = src_x_res;
+		y_res = src_y_res;
+		z_res = src_z_res;
+		words_per_row = (x_res + 63) / 64;
+		words.assign(words_per_row * y_res * z_res, 0);
+	}
+
+	void clear(void)
+	{
+		words.clear();
+		x_res = y_res = z_res = words_per_row = 0;
+	}
+
+	uint64_t* row(const size_t y, const size_t z)
+	{
+		return &words[(y + z * y_res) * words_per_row];
+	}
+
+	const uint64_t* row(const size_t y, const size_t z) const
+	{
+		return &words[(y + z * y_res) * words_per_row];
+	}
+
+	bool test(const size_t x, const size_t y, const size_t z) const
+	{
+		return (row(y, z)[x >> 6] >> (x & 63)) & 1;
+	}
+
+	void set(const size_t x, const size_t y, const size_t z)
+	{
+		row(y, z)[x >> 6] |= uint64_t(1) << (x & 63);
+	}
+
+	void reset(const size_t x, const size_t y, const size_t z)
+	{
+		row(y, z)[x >> 6] &= ~(uint64_t(1) << (x & 63));
+	}
+
+	// Same as above, but using the flattened index x + y*x_res + z*x_res*y_res
+	bool test(const size_t index) const
+	{
+		const size_t r = index / x_res;
+		const size_t x = index - r * x_res;
+		return (words[r * words_per_row + (x >> 6)] >> (x & 63)) & 1;
+	}
+
+	void set(const size_t index)
+	{
+		const size_t r = index / x_res;
+		const size_t x = index - r * x_res;
+		words[r * words_per_row + (x >> 6)] |= uint64_t(1) << (x & 63);
+	}
+
+	void reset(const size_t index)
+	{
+		const size_t r = index / x_res;
+		const size_t x = index - r * x_res;
+		words[r * words_per_row + (x >> 6)] &= ~(uint64_t(1) << (x & 63));
+	}
+
+	// Set the cells [x_begin, x_end) of row (y, z)
+	void set_range(const size_t x_begin, const size_t x_end, const size_t y, const size_t z)
+	{
+		if (x_begin >= x_end)
+			return;
+
+		uint64_t* r = row(y, z);
+
+		const size_t first_word = x_begin >> 6;
+		const size_t last_word = (x_end - 1) >> 6;
+		const uint64_t first_mask = ~uint64_t(0) << (x_begin & 63);
+		const uint64_t last_mask = ~uint64_t(0) >> (63 - ((x_end - 1) & 63));
+
+		if (first_word == last_word)
+		{
+			r[first_word] |= first_mask & last_mask;
+			return;
+		}
+
+		r[first_word] |= first_mask;
+
+		for (size_t w = first_word + 1; w < last_word; w++)
+			r[w] = ~uint64_t(0);
+
+		r[last_word] |= last_mask;
+	}
+
+	size_t count(void) const
+	{
+		size_t n = 0;
+
+		for (size_t i = 0; i < words.size(); i++)
+			n += count_set_bits(words[i]);
+
+		return n;
+	}
+
+	// Call func(x, y, z) for every set cell in the z-slab [z_begin, z_end)
+	template<class T>
+	void for_each_set(const size_t z_begin, const size_t z_end, T func) const
+	{
+		for (size_t z = z_begin; z < z_end; z++)
+		{
+			for (size_t y = 0; y < y_res; y++)
+			{
+				const uint64_t* r = row(y, z);
+
+				for (size_t w = 0; w < words_per_row; w++)
+				{
+					for (uint64_t bits = r[w]; bits != 0; bits &= bits - 1)
+						func(w * 64 + count_trailing_zeros(bits), y, z);
+				}
+			}
+		}
+	}
+
+	template<class T>
+	void for_each_set(T func) const
+	{
+		for_each_set(0, z_res, func);
+	}
+
+	// Mark the empty cells that have at least one of their 6 neighbours set,
+	// for the z-slab [z_begin, z_end) of surface (which must already be
+	// sized to match). The x neighbours come from shifting the row by one
+	// bit either way; the y and z neighbours are just the adjacent rows.
+	void get_surface(occupancy_grid& surface, const size_t z_begin, const size_t z_end) const
+	{
+		const size_t last_word = words_per_row - 1;
+		const uint64_t last_word_mask = (x_res & 63) ? (uint64_t(1) << (x_res & 63)) - 1 : ~uint64_t(0);
+
+		for (size_t z = z_begin; z < z_end; z++)
+		{
+			for (size_t y = 0; y < y_res; y++)
+			{
+				const uint64_t* r = row(y, z);
+				const uint64_t* r_y0 = y > 0 ? row(y - 1, z) : 0;
+				const uint64_t* r_y1 = y + 1 < y_res ? row(y + 1, z) : 0;
+				const uint64_t* r_z0 = z > 0 ? row(y, z - 1) : 0;
+				const uint64_t* r_z1 = z + 1 < z_res ? row(y, z + 1) : 0;
+
+				uint64_t* out = surface.row(y, z);
+
+				for (size_t w = 0; w < words_per_row; w++)
+				{
+					// x - 1 neighbour set
+					uint64_t n = (r[w] << 1) | (w > 0 ? r[w - 1] >> 63 : 0);
+
+					// x + 1 neighbour set
+					n |= (r[w] >> 1) | (w < last_word ? r[w + 1] << 63 : 0);
+
+					if (r_y0) n |= r_y0[w];
+					if (r_y1) n |= r_y1[w];
+					if (r_z0) n |= r_z0[w];
+					if (r_z1) n |= r_z1[w];
+
+					n &= ~r[w];
+
+					if (w == last_word)
+						n &= last_word_mask;
+
+					out[w] = n;
+				}
+			}
+		}
+	}
+};
+
+
+// Compressed sparse row list of voxel indices, one row per lattice point.
+// The voxels of row i are ids[offsets[i]] up to (but not including)
+// ids[offsets[i + 1]], so the whole structure is just two flat arrays.
+// It is filled in two passes: store each row's count in offsets[i + 1],
+// call build_offsets(), then write each row's ids starting at offsets[i].
+class csr_voxel_list
+{
+public:
+	vector<uint32_t> offsets;
+	vector<uint32_t> ids;
+
+	void resize(const size_t num_rows)
+	{
+		offsets.resize(num_rows + 1);
+		offsets[0] = 0;
+	}
+
+	// Turn the per-row counts into offsets, and size the id array to fit
+	void build_offsets(void)
+	{
+		for (size_t i = 1; i < offsets.size(); i++)
+			offsets[i] += offsets[i - 1];
+
+		ids.resize(offsets.back());
+	}
+
+	size_t size(const size_t row) const
+	{
+		return offsets[row + 1] - offsets[row];
+	}
+
+	const uint32_t* begin(const size_t row) const
+	{
+		return ids.data() + offsets[row];
+	}
+
+	const uint32_t* end(const size_t row) const
+	{
+		return ids.data() + offsets[row + 1];
+	}
+};
+
+
+// Sparse storage for a 3D array of cells, as 8x8x8 bricks that are only
+// allocated once one of their cells is written to.
+// Every brick that was never written to shares slot 0, which always holds
+// empty_value, so a lookup is the same two loads wherever the cell is:
+// cells[brick_index[brick] * brick_cells + offset within the brick].
+// Copies share the bricks until one of them is written to, so that many
+// instances of one model cost one set of bricks.
+template<class T>
+class brick_map
+{
+public:
+	static const size_t brick_shift = 3;
+	static const size_t brick_edge = size_t(1) << brick_shift;
+	static const size_t brick_mask = brick_edge - 1;
+	static const size_t brick_cells = brick_edge * brick_edge * brick_edge;
+
+	size_t x_res = 0;
+	size_t y_res = 0;
+	size_t z_res = 0;
+	size_t bricks_x = 0;
+	size_t bricks_y = 0;
+	size_t bricks_z = 0;
+	T empty_value = T();
+
+	// Resize, and set all of the cells to src_empty_value
+	void resize(const size_t src_x_res, const size_t src_y_res, const size_t src_z_res, const T& src_empty_value)
+	{
+		x_res = src_x_res;
+		y_res = src_y_res;
+		z_res = src_z_res;
+		bricks_x = (x_res + brick_mask) >> brick_shift;
+		bricks_y = (y_res + brick_mask) >> brick_shift;
+		bricks_z = (z_res + brick_mask) >> brick_shift;
+		empty_value = src_empty_value;
+
+		storage = std::make_shared<bricks>();
+		storage->brick_index.assign(bricks_x * bricks_y * bricks_z, 0);
+		storage->cells.assign(brick_cells, empty_value);
+	}
+
+	void clear(void)
+	{
+		storage.reset();
+		x_res = y_res = z_res = bricks_x = bricks_y = bricks_z = 0;
+	}
+
+	size_t get_brick(const size_t x, const size_t y, const size_t z) const
+	{
+		return (x >> brick_shift) + (y >> brick_shift) * bricks_x + (z >> brick_shift) * bricks_x * bricks_y;
+	}
+
+	static size_t get_brick_offset(const size_t x, const size_t y, const size_t z)
+	{
+		return (x & brick_mask) + ((y & brick_mask) << brick_shift) + ((z & brick_mask) << (2 * brick_shift));
+	}
+
+	const T& get(const size_t x, const size_t y, const size_t z) const
+	{
+		return storage->cells[storage->brick_index[get_brick(x, y, z)] * brick_cells + get_brick_offset(x, y, z)];
+	}
+
+	// Allocates the brick if need be, and takes a private copy of the
+	// bricks if they are shared, so the reference is only good until the
+	// next call
+	T& at(const size_t x, const size_t y, const size_t z)
+	{
+		if (storage.use_count() > 1)
+			storage = std::make_shared<bricks>(*storage);
+
+		int32_t& slot = storage->brick_index[get_brick(x, y, z)];
+
+		if (slot == 0)
+		{
+			slot = static_cast<int32_t>(storage->cells.size() / brick_cells);
+			storage->cells.resize(storage->cells.size() + brick_cells, empty_value);
+		}
+
+		return storage->cells[slot * brick_cells + get_brick_offset(x, y, z)];
+	}
+
+	// Same as above, but using the flattened index x + y*x_res + z*x_res*y_res
+	const T& get(const size_t index) const
+	{
+		const size_t r = index / x_res;
+		return get(index - r * x_res, r % y_res, r / y_res);
+	}
+
+	T& at(const size_t index)
+	{
+		const size_t r = index / x_res;
+		return at(index - r * x_res, r % y_res, r / y_res);
+	}
+
+	// For the row classifiers, which do the lookup themselves
+	const int32_t* get_brick_index_data(void) const
+	{
+		return storage->brick_index.data();
+	}
+
+	const T* get_cell_data(void) const
+	{
+		return storage->cells.data();
+	}
+
+	// Not counting the shared empty brick
+	size_t brick_count(void) const
+	{
+		return storage ? storage->cells.size() / brick_cells - 1 : 0;
+	}
+
+	// Including any bricks that are shared with copies
+	size_t get_storage_bytes(void) const
+	{
+		return storage ? storage->brick_index.size() * sizeof(int32_t) + storage->cells.size() * sizeof(T) : 0;
+	}
+
+	// Whether the bricks are the same ones as other's, rather than a copy
+	bool shares_storage_with(const brick_map& other) const
+	{
+		return storage && storage == other.storage;
+	}
+
+private:
+	struct bricks
+	{
+		vector<int32_t> brick_index;
+		vector<T> cells;
+	};
+
+	std::shared_ptr<bricks> storage;
+};
+
+
+// An inclusive box of lattice points
+struct lattice_box
+{
+	int min[3];
+	int max[3];
+};
+
+// A regular lattice of x_res * y_res * z_res points, starting at lattice_min
+// and spaced step_size apart. The centre of a point is worked out from its
+// coordinates when it is needed, instead of being stored.
+class lattice_descriptor
+{
+public:
+	custom_math::position_3 lattice_min;
+	custom_math::position_3 step_size;
+	size_t x_res = 0, y_res = 0, z_res = 0;
+
+	lattice_descriptor(void)
+	{
+	}
+
+	// A lattice with its first and last points at -grid_max and +grid_max
+	lattice_descriptor(const size_t src_x_res, const size_t src_y_res, const size_t src_z_res, const float x_grid_max, const float y_grid_max, const float z_grid_max)
+	{
+		x_res = src_x_res;
+		y_res = src_y_res;
+		z_res = src_z_res;
+
+		lattice_min = custom_math::position_3(-x_grid_max, -y_grid_max, -z_grid_max);
+
+		step_size = custom_math::position_3(
+			(x_grid_max - lattice_min.x) / (x_res - 1),
+			(y_grid_max - lattice_min.y) / (y_res - 1),
+			(z_grid_max - lattice_min.z) / (z_res - 1));
+	}
+
+	size_t size(void) const
+	{
+		return x_res * y_res * z_res;
+	}
+
+	size_t index(const size_t x, const size_t y, const size_t z) const
+	{
+		return x + y * x_res + z * x_res * y_res;
+	}
+
+	custom_math::position_3 centre(const size_t x, const size_t y, const size_t z) const
+	{
+		return custom_math::position_3(lattice_min.x + x * step_size.x, lattice_min.y + y * step_size.y, lattice_min.z + z * step_size.z);
+	}
+
+	// The lattice points inside the axis-aligned box centre +/- half_extent,
+	// plus a little slack for rounding. Returns false if there are none.
+	bool get_box(const glm::vec3& box_centre, const glm::vec3& half_extent, lattice_box& b) const
+	{
+		const float min[3] = { lattice_min.x, lattice_min.y, lattice_min.z };
+		const float step[3] = { step_size.x, step_size.y, step_size.z };
+		const int res[3] = { static_cast<int>(x_res), static_cast<int>(y_res), static_cast<int>(z_res) };
+
+		for (int i = 0; i < 3; i++)
+		{
+			const float slack = step[i] * 1e-3f;
+
+			b.min[i] = std::max(0, static_cast<int>(floorf((box_centre[i] - half_extent[i] - slack - min[i]) / step[i])));
+			b.max[i] = std::min(res[i] - 1, static_cast<int>(ceilf((box_centre[i] + half_extent[i] + slack - min[i]) / step[i])));
+
+			if (b.min[i] > b.max[i])
+				return false;
+		}
+
+		return true;
+	}
+};
+
+
+// Sparse 64-tree over the set cells of an occupancy_grid.
+// Each node splits its cube into 4x4x4 children, and keeps a bit for each
+// child that holds at least one set cell. Only those children are stored,
+// one after the other from first_child, so child i of a node is at
+// first_child + (the number of set bits below bit i). At the last level
+// the bits are the cells themselves.
+// An empty region is skipped with one test, at whatever level it is empty.
+class occupancy_tree
+{
+public:
+	struct node
+	{
+		uint64_t child_mask = 0;
+		uint32_t first_child = 0;
+	};
+
+	// The root covers 4^levels cells along each axis
+	size_t levels = 0;
+	size_t x_res = 0;
+	size_t y_res = 0;
+	size_t z_res = 0;
+	vector<node> nodes;
+
+	void clear(void)
+	{
+		nodes.clear();
+		levels = x_res = y_res = z_res = 0;
+	}
+
+	void build(const occupancy_grid& cells)
+	{
+		clear();
+
+		x_res = cells.x_res;
+		y_res = cells.y_res;
+		z_res = cells.z_res;
+
+		const size_t max_res = std::max(x_res, std::max(y_res, z_res));
+
+		if (max_res == 0)
+			return;
+
+		levels = 1;
+
+		while ((size_t(1) << (2 * levels)) < max_res)
+			levels++;
+
+		// The occupancy of each level, from the cells up to the children
+		// of the root; a coarse cell is set if any of its 4x4x4 are
+		vector<occupancy_grid> coarse(levels - 1);
+		vector<const occupancy_grid*> pyramid(levels);
+		pyramid[0] = &cells;
+
+		for (size_t level = 1; level < levels; level++)
+		{
+			const occupancy_grid& fine = *pyramid[level - 1];
+			occupancy_grid& g = coarse[level - 1];
+
+			g.resize((fine.x_res + 3) / 4, (fine.y_res + 3) / 4, (fine.z_res + 3) / 4);
+
+			fine.for_each_set([&](const size_t x, const size_t y, const size_t z)
+				{
+					g.set(x >> 2, y >> 2, z >> 2);
+				});
+
+			pyramid[level] = &g;
+		}
+
+		nodes.resize(1);
+		build_node(pyramid, 0, levels - 1, 0, 0, 0);
+	}
+
+	bool test(const size_t x, const size_t y, const size_t z) const
+	{
+		if (nodes.empty() || x >= x_res || y >= y_res || z >= z_res)
+			return false;
+
+		size_t index = 0;
+
+		for (size_t level = levels; level-- > 0; )
+		{
+			const size_t shift = 2 * level;
+			const unsigned int bit = static_cast<unsigned int>(((x >> shift) & 3) + (((y >> shift) & 3) << 2) + (((z >> shift) & 3) << 4));
+			const uint64_t mask = nodes[index].child_mask;
+
+			if (!((mask >> bit) & 1))
+				return false;
+
+			if (level == 0)
+				return true;
+
+			index = get_child(index, bit);
+		}
+
+		return false;
+	}
+
+	// Whether any set cell is inside the inclusive box of cells b
+	bool overlaps(const lattice_box& b) const
+	{
+		if (nodes.empty())
+			return false;
+
+		return overlaps_node(0, levels - 1, 0, 0, 0, b);
+	}
+
+	// Call func(t_enter, t_exit, x, y, z) for each set cell (x, y, z) that
+	// the ray origin + t * direction passes through, for t in
+	// [t_begin, t_end], in order along the ray. The ray is in cell units,
+	// so that cell (x, y, z) spans [x, x + 1) and so on.
+	// Stops early if func returns false.
+	template<class T>
+	void for_each_cell_on_ray(const float origin[3], const float direction[3], float t_begin, float t_end, T func) const
+	{
+		if (nodes.empty())
+			return;
+
+		const float size = static_cast<float>(size_t(1) << (2 * levels));
+
+		float inv_direction[3];
+
+		for (int i = 0; i < 3; i++)
+		{
+			if (direction[i] == 0.0f)
+			{
+				if (origin[i] < 0.0f || origin[i] >= size)
+					return;
+
+				inv_direction[i] = numeric_limits<float>::infinity();
+				continue;
+			}
+
+			inv_direction[i] = 1.0f / direction[i];
+
+			float t0 = (0.0f - origin[i]) * inv_direction[i];
+			float t1 = (size - origin[i]) * inv_direction[i];
+
+			if (t0 > t1)
+				std::swap(t0, t1);
+
+			t_begin = std::max(t_begin, t0);
+			t_end = std::min(t_end, t1);
+		}
+
+		if (t_begin > t_end)
+			return;
+
+		visit_node(0, levels - 1, 0, 0, 0, origin, direction, inv_direction, t_begin, t_end, func);
+	}
+
+private:
+	size_t get_child(const size_t index, const unsigned int bit) const
+	{
+		return nodes[index].first_child + count_set_bits(nodes[index].child_mask & ((uint64_t(1) << bit) - 1));
+	}
+
+	// The children of node (nx, ny, nz) are the cells (nx * 4 + i, ...) of pyramid[level]
+	void build_node(const vector<const occupancy_grid*>& pyramid, const size_t index, const size_t level, const size_t nx, const size_t ny, const size_t nz)
+	{
+		const occupancy_grid& g = *pyramid[level];
+
+		uint64_t mask = 0;
+
+		for (size_t k = 0; k < 4; k++)
+		{
+			for (size_t j = 0; j < 4; j++)
+			{
+				for (size_t i = 0; i < 4; i++)
+				{
+					const size_t x = nx * 4 + i, y = ny * 4 + j, z = nz * 4 + k;
+
+					if (x < g.x_res && y < g.y_res && z < g.z_res && g.test(x, y, z))
+						mask |= uint64_t(1) << (i + (j << 2) + (k << 4));
+				}
+			}
+		}
+
+		nodes[index].child_mask = mask;
+
+		if (level == 0 || mask == 0)
+			return;
+
+		const size_t first_child = nodes.size();
+
+		nodes[index].first_child = static_cast<uint32_t>(first_child);
+		nodes.resize(first_child + count_set_bits(mask));
+
+		size_t child = first_child;
+
+		for (uint64_t bits = mask; bits != 0; bits &= bits - 1)
+		{
+			const unsigned int bit = count_trailing_zeros(bits);
+
+			build_node(pyramid, child++, level - 1, nx * 4 + (bit & 3), ny * 4 + ((bit >> 2) & 3), nz * 4 + (bit >> 4));
+		}
+	}
+
+	bool overlaps_node(const size_t index, const size_t level, const size_t nx, const size_t ny, const size_t nz, const lattice_box& b) const
+	{
+		const int shift = static_cast<int>(2 * level);
+		const int child_size = 1 << shift;
+		const int n[3] = { int(nx), int(ny), int(nz) };
+		const uint64_t mask = nodes[index].child_mask;
+
+		// The range of children that the box covers, along each axis
+		int lo[3], hi[3];
+
+		for (int i = 0; i < 3; i++)
+		{
+			const int base = n[i] * 4;
+
+			lo[i] = std::max(base, b.min[i] >> shift) - base;
+			hi[i] = std::min(base + 3, b.max[i] >> shift) - base;
+
+			if (lo[i] > hi[i])
+				return false;
+		}
+
+		for (int k = lo[2]; k <= hi[2]; k++)
+		{
+			for (int j = lo[1]; j <= hi[1]; j++)
+			{
+				for (int i = lo[0]; i <= hi[0]; i++)
+				{
+					const unsigned int bit = static_cast<unsigned int>(i + (j << 2) + (k << 4));
+
+					if (!((mask >> bit) & 1))
+						continue;
+
+					// A child that is in the tree has at least one set cell
+					if (level == 0)
+						return true;
+
+					const int c[3] = { n[0] * 4 + i, n[1] * 4 + j, n[2] * 4 + k };
+
+					bool inside = true;
+
+					for (int a = 0; a < 3; a++)
+						inside = inside && c[a] * child_size >= b.min[a] && c[a] * child_size + child_size - 1 <= b.max[a];
+
+					if (inside || overlaps_node(get_child(index, bit), level - 1, c[0], c[1], c[2], b))
+						return true;
+				}
+			}
+		}
+
+		return false;
+	}
+
+	// Step through the 4x4x4 children of a node in the order that the ray
+	// meets them, for t in [t_begin, t_end] (which is inside the node)
+	template<class T>
+	bool visit_node(const size_t index, const size_t level, const size_t nx, const size_t ny, const size_t nz,
+		const float origin[3], const float direction[3], const float inv_direction[3], const float t_begin, const float t_end, T& func) const
+	{
+		const float child_size = static_cast<float>(size_t(1) << (2 * level));
+		const size_t n[3] = { nx, ny, nz };
+		const uint64_t mask = nodes[index].child_mask;
+
+		int c[3], step[3];
+		float t_next[3], t_delta[3];
+
+		for (int i = 0; i < 3; i++)
+		{
+			const float base = n[i] * 4 * child_size;
+			const float p = origin[i] + direction[i] * t_begin;
+
+			c[i] = std::max(0, std::min(3, static_cast<int>(floorf((p - base) / child_size))));
+
+			if (direction[i] > 0.0f)
+			{
+				step[i] = 1;
+				t_next[i] = (base + (c[i] + 1) * child_size - origin[i]) * inv_direction[i];
+				t_delta[i] = child_size * inv_direction[i];
+			}
+			else if (direction[i] < 0.0f)
+			{
+				step[i] = -1;
+				t_next[i] = (base + c[i] * child_size - origin[i]) * inv_direction[i];
+				t_delta[i] = -child_size * inv_direction[i];
+			}
+			else
+			{
+				step[i] = 0;
+				t_next[i] = t_delta[i] = numeric_limits<float>::infinity();
+			}
+		}
+
+		float t = t_begin;
+
+		while (true)
+		{
+			const unsigned int bit = static_cast<unsigned int>(c[0] + (c[1] << 2) + (c[2] << 4));
+			const int axis = (t_next[0] < t_next[1]) ? (t_next[0] < t_next[2] ? 0 : 2) : (t_next[1] < t_next[2] ? 1 : 2);
+			const float t_exit = std::min(t_next[axis], t_end);
+
+			if ((mask >> bit) & 1)
+			{
+				const size_t cx = nx * 4 + c[0], cy = ny * 4 + c[1], cz = nz * 4 + c[2];
+
+				if (level == 0)
+				{
+					if (!func(t, t_exit, cx, cy, cz))
+						return false;
+				}
+				else if (!visit_node(get_child(index, bit), level - 1, cx, cy, cz, origin, direction, inv_direction, t, t_exit, func))
+				{
+					return false;
+				}
+			}
+
+			if (t_exit >= t_end)
+				break;
+
+			c[axis] += step[axis];
+
+			if (c[axis] < 0 || c[axis] > 3)
+				break;
+
+			t = t_next[axis];
+			t_next[axis] += t_delta[axis];
+		}
+
+		return true;
+	}
+};
+
+
+// Batch classification of lattice rows against the voxel grid.
+// A row of points is classified 8 (AVX2) or 4 (SSE2) points at a time,
+// with the AVX2 kernel picked at run time when the CPU supports it. (A
+// 16-wide AVX-512 kernel measured slower than AVX2, so there isn't one.)
+// Every kernel does the same float operations in the same order as
+// classify_row_scalar, so they all give identical results.
+
+// The parts of a voxel_object that the row classifiers need, in flat form
+struct voxel_grid_view
+{
+	float grid_min[3];
+	float cell_size;
+	int res[3];
+	int bricks_x;              // vo_grid_cells.bricks_x
+	int bricks_xy;             // vo_grid_cells.bricks_x * bricks_y
+	const int32_t* bricks;     // vo_grid_cells.brick_index
+	const int32_t* cells;      // vo_grid_cells.cells
+};
+
+// The voxel index stored in grid cell (x, y, z), or -1.
+// The cells are in 8x8x8 bricks; see brick_map.
+inline int32_t get_grid_cell(const voxel_grid_view& grid, const int x, const int y, const int z)
+{
+	const int32_t slot = grid.bricks[(x >> 3) + (y >> 3) * grid.bricks_x + (z >> 3) * grid.bricks_xy];
+
+	return grid.cells[slot * 512 + (x & 7) + ((y & 7) << 3) + ((z & 7) << 6)];
+}
+
+// Classify the points origin + x * step, for x in [x_begin, x_end).
+// Hits set their bit in density_row (which must be cleared beforehand)
+// and store their voxel index in collisions_row[x].
+typedef void (*classify_row_func)(const voxel_grid_view& grid, const float origin[3], const float step[3], size_t x_begin, size_t x_end, uint64_t* density_row, size_t* collisions_row);
+
+inline void or_density_bits(uint64_t* density_row, const size_t x, const uint64_t bits)
+{
+	const size_t shift = x & 63;
+
+	density_row[x >> 6] |= bits << shift;
+
+	if (shift != 0 && (bits >> (64 - shift)) != 0)
+		density_row[(x >> 6) + 1] |= bits >> (64 - shift);
+}
+
+inline void classify_row_scalar(const voxel_grid_view& grid, const float origin[3], const float step[3], size_t x_begin, size_t x_end, uint64_t* density_row, size_t* collisions_row)
+{
+	for (size_t x = x_begin; x < x_end; x++)
+	{
+		const float fx = static_cast<float>(x);
+		const float p[3] = { origin[0] + fx * step[0], origin[1] + fx * step[1], origin[2] + fx * step[2] };
+
+		int cell[3];
+		bool in_grid = true;
+
+		// Test the quotient rather than the cell, since the conversion
+		// rounds towards zero and would put points just below grid_min in
+		// the first cell
+		for (int i = 0; i < 3; i++)
+		{
+			const float q = (p[i] - grid.grid_min[i]) / grid.cell_size;
+
+			cell[i] = static_cast<int>(q);
+			in_grid = in_grid && q >= 0.0f && cell[i] < grid.res[i];
+		}
+
+		if (!in_grid)
+			continue;
+
+		const int32_t voxel_index = get_grid_cell(grid, cell[0], cell[1], cell[2]);
+
+		if (voxel_index < 0)
+			continue;
+
+		density_row[x >> 6] |= uint64_t(1) << (x & 63);
+		collisions_row[x] = voxel_index;
+	}
+}
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+
+#define VOX_VIEW_X86_SIMD
+
+#if defined(__GNUC__) || defined(__clang__)
+#define VOX_VIEW_TARGET(x) __attribute__((target(x)))
+#else
+#define VOX_VIEW_TARGET(x)
+#endif
+
+inline void classify_row_sse2(const voxel_grid_view& grid, const float origin[3], const float step[3], size_t x_begin, size_t x_end, uint64_t* density_row, size_t* collisions_row)
+{
+	const __m128 lane = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+	const __m128 cell_size = _mm_set1_ps(grid.cell_size);
+
+	__m128 o[3], s[3], m[3];
+	__m128i r[3];
+
+	for (int i = 0; i < 3; i++)
+	{
+		o[i] = _mm_set1_ps(origin[i]);
+		s[i] = _mm_set1_ps(step[i]);
+		m[i] = _mm_set1_ps(grid.grid_min[i]);
+		r[i] = _mm_set1_epi32(grid.res[i]);
+	}
+
+	size_t x = x_begin;
+
+	for (; x + 4 <= x_end; x += 4)
+	{
+		const __m128 fx = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), lane);
+
+		__m128i in_grid = _mm_set1_epi32(-1);
+		alignas(16) int32_t cell[3][4];
+
+		for (int i = 0; i < 3; i++)
+		{
+			const __m128 p = _mm_add_ps(o[i], _mm_mul_ps(fx, s[i]));
+			const __m128 q = _mm_div_ps(_mm_sub_ps(p, m[i]), cell_size);
+			const __m128i c = _mm_cvttps_epi32(q);
+
+			in_grid = _mm_and_si128(in_grid, _mm_and_si128(_mm_castps_si128(_mm_cmpge_ps(q, _mm_setzero_ps())), _mm_cmplt_epi32(c, r[i])));
+
+			_mm_store_si128(reinterpret_cast<__m128i*>(cell[i]), c);
+		}
+
+		const int lanes = _mm_movemask_ps(_mm_castsi128_ps(in_grid));
+
+		if (lanes == 0)
+			continue;
+
+		// No gathers in SSE2, so look the voxels up one at a time
+		int32_t voxel_index[4];
+		int hits = 0;
+
+		for (int l = 0; l < 4; l++)
+		{
+			if (!(lanes & (1 << l)))
+				continue;
+
+			voxel_index[l] = get_grid_cell(grid, cell[0][l], cell[1][l], cell[2][l]);
+
+			if (voxel_index[l] >= 0)
+				hits |= 1 << l;
+		}
+
+		if (hits == 0)
+			continue;
+
+		or_density_bits(density_row, x, static_cast<uint64_t>(hits));
+
+		for (int l = 0; l < 4; l++)
+			if (hits & (1 << l))
+				collisions_row[x + l] = voxel_index[l];
+	}
+
+	classify_row_scalar(grid, origin, step, x, x_end, density_row, collisions_row);
+}
+
+VOX_VIEW_TARGET("avx2")
+inline void classify_row_avx2(const voxel_grid_view& grid, const float origin[3], const float step[3], size_t x_begin, size_t x_end, uint64_t* density_row, size_t* collisions_row)
+{
+	const __m256 lane = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+	const __m256 cell_size = _mm256_set1_ps(grid.cell_size);
+	const __m256i bricks_x = _mm256_set1_epi32(grid.bricks_x);
+	const __m256i bricks_xy = _mm256_set1_epi32(grid.bricks_xy);
+	const __m256i brick_mask = _mm256_set1_epi32(7);
+	const __m256i minus_one = _mm256_set1_epi32(-1);
+
+	__m256 o[3], s[3], m[3];
+	__m256i r[3];
+
+	for (int i = 0; i < 3; i++)
+	{
+		o[i] = _mm256_set1_ps(origin[i]);
+		s[i] = _mm256_set1_ps(step[i]);
+		m[i] = _mm256_set1_ps(grid.grid_min[i]);
+		r[i] = _mm256_set1_epi32(grid.res[i]);
+	}
+
+	size_t x = x_begin;
+
+	for (; x + 8 <= x_end; x += 8)
+	{
+		const __m256 fx = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(x)), lane);
+
+		__m256i c[3];
+		__m256i in_grid = minus_one;
+
+		for (int i = 0; i < 3; i++)
+		{
+			const __m256 p = _mm256_add_ps(o[i], _mm256_mul_ps(fx, s[i]));
+			const __m256 q = _mm256_div_ps(_mm256_sub_ps(p, m[i]), cell_size);
+			c[i] = _mm256_cvttps_epi32(q);
+
+			// 0 <= q, c < res
+			in_grid = _mm256_and_si256(in_grid, _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(q, _mm256_setzero_ps(), _CMP_GE_OQ)), _mm256_cmpgt_epi32(r[i], c[i])));
+		}
+
+		if (_mm256_testz_si256(in_grid, in_grid))
+			continue;
+
+		// Look up the brick, then the cell within it; points outside of
+		// the grid get the empty brick
+		const __m256i brick = _mm256_add_epi32(_mm256_srli_epi32(c[0], 3), _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(c[1], 3), bricks_x), _mm256_mullo_epi32(_mm256_srli_epi32(c[2], 3), bricks_xy)));
+		const __m256i slot = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), grid.bricks, brick, in_grid, 4);
+
+		const __m256i offset = _mm256_add_epi32(_mm256_and_si256(c[0], brick_mask), _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(c[1], brick_mask), 3), _mm256_slli_epi32(_mm256_and_si256(c[2], brick_mask), 6)));
+		const __m256i cell_index = _mm256_add_epi32(_mm256_slli_epi32(slot, 9), offset);
+		const __m256i voxel_index = _mm256_mask_i32gather_epi32(minus_one, grid.cells, cell_index, in_grid, 4);
+
+		const int hits = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(voxel_index, minus_one)));
+
+		if (hits == 0)
+			continue;
+
+		or_density_bits(density_row, x, static_cast<uint64_t>(hits));
+
+		alignas(32) int32_t v[8];
+		_mm256_store_si256(reinterpret_cast<__m256i*>(v), voxel_index);
+
+		for (int l = 0; l < 8; l++)
+			if (hits & (1 << l))
+				collisions_row[x + l] = v[l];
+	}
+
+	classify_row_scalar(grid, origin, step, x, x_end, density_row, collisions_row);
+}
+
+// 0 = SSE2, 1 = AVX2
+inline int get_cpu_simd_level(void)
+{
+#if defined(_MSC_VER)
+	int info[4];
+
+	__cpuid(info, 0);
+
+	if (info[0] < 7)
+		return 0;
+
+	__cpuid(info, 1);
+
+	// The OS must save the AVX state (OSXSAVE, then XCR0 bits 1 and 2)
+	if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6)
+		return 0;
+
+	__cpuidex(info, 7, 0);
+
+	return (info[1] & (1 << 5)) != 0 ? 1 : 0;
+#else
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+		return 1;
+
+	return 0;
+#endif
+}
+
+#endif
+
+// The widest row classifier that this CPU supports
+inline classify_row_func get_classify_row_func(void)
+{
+#ifdef VOX_VIEW_X86_SIMD
+	static const int level = get_cpu_simd_level();
+
+	if (level == 1)
+		return classify_row_avx2;
+
+	return classify_row_sse2;
+#else
+	return classify_row_scalar;
+#endif
+}
+
+
+class voxel_object
+{
+public:
+
+
+
+	custom_math::vertex_3 vo_grid_min;
+	custom_math::vertex_3 vo_grid_max;
+	// 3D array of voxel indices (stores -1 for empty cells)
+
+	const float cell_size = 1.0;
+
+	// Triangles data
+	indexed_mesh mesh;
+	//custom_math::vertex_3 min_location, max_location;
+
+	// Voxel (x, y, z) is centred at get_voxel_centre(x, y, z); only the
+	// translation that centres the model on the origin is stored
+	custom_math::position_3 voxel_offset;
+
+	// Note: when destroying a voxel, reset voxel_densities at its index and set vo_grid_cells[index] to -1
+	// then re-generate the triangles
+	occupancy_grid voxel_densities;
+	brick_map<int32_t> vo_grid_cells;
+
+	// Which of the vo_grid_cells hold a voxel, for skipping empty space
+	occupancy_tree voxel_tree;
+
+	// Only the bricks that hold a solid voxel are allocated
+	brick_map<glm::vec4> voxel_colours;
+	size_t voxel_x_res = 0;
+	size_t voxel_y_res = 0;
+	size_t voxel_z_res = 0;
+
+	// The background points are the points of this lattice; only the
+	// per-point results below are stored
+	lattice_descriptor background_lattice;
+	occupancy_grid background_densities;
+	vector<size_t> background_collisions;
+
+	occupancy_grid background_surface_densities;
+	csr_voxel_list background_surface_collisions;
+
+	// Set by get_background_points; cleared by the renderer once the surface points are uploaded
+	bool background_dirty = true;
+
+	// The model matrix that the background was last classified with, for
+	// update_background_points. Only meaningful if background_sampled is set.
+	glm::mat4 background_model_matrix = glm::mat4(1.0f);
+	bool background_sampled = false;
+	occupancy_grid background_update_mask;
+
+	glm::mat4 model_matrix = glm::mat4(1.0f);
+	float u = 0.0f, v = 0.0f;
+
+
+
+
+	//// Initialize the grid based on voxel data
+	//void initialize(const std::vector<custom_math::vertex_3>& voxel_centres/*,
+	//	const std::vector<float>& voxel_densities*/) {
+
+	//	// Find min/max extents
+	//	if (voxel_centres.empty()) return;
+
+
+	//}
+
+
+
+	custom_math::position_3 get_voxel_centre(const size_t x, const size_t y, const size_t z) const
+	{
+		static const float pi = 4.0f * atanf(1.0f);
+
+		custom_math::position_3 centre(x * cell_size, y * cell_size, z * cell_size);
+		centre.rotate_x(pi - pi / 2.0f);
+
+		return centre + voxel_offset;
+	}
+
+	custom_math::position_3 get_voxel_centre(const size_t index) const
+	{
+		const size_t r = index / voxel_x_res;
+		return get_voxel_centre(index - r * voxel_x_res, r % voxel_y_res, r / voxel_y_res);
+	}
+
+	size_t get_cell_count(void) const
+	{
+		return voxel_x_res * voxel_y_res * voxel_z_res;
+	}
+
+	// Bytes used by the per-cell voxel storage
+	size_t get_storage_bytes(void) const
+	{
+		return voxel_densities.words.size() * sizeof(uint64_t) + vo_grid_cells.get_storage_bytes() + voxel_colours.get_storage_bytes()
+			+ voxel_tree.nodes.size() * sizeof(occupancy_tree::node);
+	}
+
+	// Find which voxel contains a point
+	bool find_voxel_containing_point(
+		const custom_math::vertex_3& point,
+		size_t& voxel_index) const 
+	{
+		// Check that the point isn't below the grid first, since the
+		// conversion to int rounds towards zero
+		if (point.x < vo_grid_min.x || point.y < vo_grid_min.y || point.z < vo_grid_min.z)
+			return false;
+
+		// Get grid cell coordinates
+		int cell_x = static_cast<int>((point.x - vo_grid_min.x) / cell_size);
+		int cell_y = static_cast<int>((point.y - vo_grid_min.y) / cell_size);
+		int cell_z = static_cast<int>((point.z - vo_grid_min.z) / cell_size);
+
+		// Check bounds
+		if (cell_x < 0 || cell_x >= vo_grid_cells.x_res ||
+			cell_y < 0 || cell_y >= vo_grid_cells.y_res ||
+			cell_z < 0 || cell_z >= vo_grid_cells.z_res) {
+			return false;  // Outside grid
+		}
+
+		const int32_t voxel_idx = vo_grid_cells.get(cell_x, cell_y, cell_z);
+
+		if (voxel_idx == -1)
+			return false;  // No voxel here
+
+		// The cell is the voxel, so there's no need for a closer check
+		voxel_index = voxel_idx;
+
+		return true;
+	}
+
+
+	// Find the first voxel that the ray origin + t * direction hits, for
+	// t >= 0, once the voxels have been transformed by the model matrix.
+	// Empty space is skipped a whole tree node at a time.
+	bool find_voxel_on_ray(
+		const custom_math::vertex_3& ray_origin,
+		const custom_math::vertex_3& ray_direction,
+		const glm::mat4& model,
+		size_t& voxel_index,
+		float& t) const
+	{
+		const glm::mat4 inv_model_matrix = glm::inverse(model);
+
+		// An affine map keeps t the same along the ray
+		const glm::vec4 local_origin = inv_model_matrix * glm::vec4(ray_origin.x, ray_origin.y, ray_origin.z, 1.0f);
+		const glm::vec4 local_direction = inv_model_matrix * glm::vec4(ray_direction.x, ray_direction.y, ray_direction.z, 0.0f);
+
+		const float origin[3] = {
+			(local_origin.x - vo_grid_min.x) / cell_size,
+			(local_origin.y - vo_grid_min.y) / cell_size,
+			(local_origin.z - vo_grid_min.z) / cell_size };
+
+		const float direction[3] = { local_direction.x / cell_size, local_direction.y / cell_size, local_direction.z / cell_size };
+
+		bool found = false;
+
+		voxel_tree.for_each_cell_on_ray(origin, direction, 0.0f, numeric_limits<float>::max(), [&](const float t_enter, const float, const size_t x, const size_t y, const size_t z)
+			{
+				voxel_index = vo_grid_cells.get(x, y, z);
+				t = t_enter;
+				found = true;
+
+				return false;
+			});
+
+		return found;
+	}
+
+	// Combine the grid with the model transformation
+	bool is_point_in_voxel_grid(const custom_math::vertex_3& test_point,
+		const glm::mat4& model,
+		size_t& voxel_index,
+		voxel_object& v) {
+		// 1. Calculate the inverse model matrix
+		glm::mat4 inv_model_matrix = glm::inverse(model);
+
+		// 2. Transform the test point with the inverse model matrix
+		glm::vec4 model_space_point(test_point.x, test_point.y, test_point.z, 1.0f);
+		glm::vec4 local_space_point = inv_model_matrix * model_space_point;
+
+		// 3. Create a vertex_3 from the transformed point
+		custom_math::vertex_3 transformed_point(
+			local_space_point.x,
+			local_space_point.y,
+			local_space_point.z
+		);
+
+		// 4. Use the grid to find the voxel
+		return find_voxel_containing_point(transformed_point, voxel_index);
+	}
+
+
+	// classify_lattice_points works through the lattice in tiles of this
+	// many rows along y and z, by this many points along x
+	static const size_t lattice_tile_size = 8;
+	static const size_t lattice_tile_x_size = 32;
+
+	// Classify the points of a regular lattice against the voxel grid,
+	// for the part of the z-slab [z_begin, z_end) that is inside bounds.
+	// The densities must be cleared beforehand; points outside of bounds
+	// are left empty.
+	// The inverse model matrix is calculated once per call, and each row is
+	// handed to the batch classifier in local space. The lattice is taken in
+	// tiles, and a tile is skipped if voxel_tree has nothing inside of it.
+	void classify_lattice_points(
+		const lattice_descriptor& lattice,
+		const lattice_box& bounds,
+		const size_t z_begin,
+		const size_t z_end,
+		const glm::mat4& model,
+		occupancy_grid& densities,
+		vector<size_t>& collisions) const
+	{
+		const glm::mat4 inv_model_matrix = glm::inverse(model);
+
+		const custom_math::position_3& lattice_min = lattice.lattice_min;
+		const custom_math::position_3& step_size = lattice.step_size;
+		const size_t lattice_x_res = lattice.x_res;
+		const size_t lattice_y_res = lattice.y_res;
+
+		const size_t x_begin = bounds.min[0], x_end = bounds.max[0] + 1;
+		const size_t y_begin = bounds.min[1], y_end = bounds.max[1] + 1;
+
+		// The steps are directions, so they ignore the translation (w = 0)
+		const glm::vec4 local_x_step = inv_model_matrix * glm::vec4(step_size.x, 0.0f, 0.0f, 0.0f);
+		const glm::vec4 local_y_step = inv_model_matrix * glm::vec4(0.0f, step_size.y, 0.0f, 0.0f);
+		const glm::vec4 local_z_step = inv_model_matrix * glm::vec4(0.0f, 0.0f, step_size.z, 0.0f);
+		const glm::vec4 local_min = inv_model_matrix * glm::vec4(lattice_min.x, lattice_min.y, lattice_min.z, 1.0f);
+
+		const voxel_grid_view grid = get_grid_view();
+		const classify_row_func classify_row = get_classify_row_func();
+
+		const float step[3] = { local_x_step.x, local_x_step.y, local_x_step.z };
+
+		const size_t z_first = std::max(z_begin, size_t(bounds.min[2]));
+		const size_t z_last = std::min(z_end, size_t(bounds.max[2] + 1));
+
+		// Half the size of the local box around a tile of lattice points,
+		// per point along each axis
+		glm::vec3 tile_half_step[3];
+
+		for (int i = 0; i < 3; i++)
+			tile_half_step[i] = glm::vec3(fabsf(local_x_step[i]), fabsf(local_y_step[i]), fabsf(local_z_step[i])) * 0.5f;
+
+		// The runs of x worth classifying, for each tile along y. There's
+		// at most one run per tile along x.
+		const size_t y_tiles = (y_end - y_begin + lattice_tile_size - 1) / lattice_tile_size;
+		const size_t max_runs = (x_end - x_begin + lattice_tile_x_size - 1) / lattice_tile_x_size;
+
+		vector<size_t> run_begin(y_tiles * max_runs), run_end(y_tiles * max_runs), runs(y_tiles);
+
+		for (size_t tz = z_first; tz < z_last; tz += lattice_tile_size)
+		{
+			const size_t tz_end = std::min(z_last, tz + lattice_tile_size);
+
+			for (size_t ty = y_begin, tile = 0; ty < y_end; ty += lattice_tile_size, tile++)
+			{
+				const size_t ty_end = std::min(y_end, ty + lattice_tile_size);
+
+				size_t* begins = &run_begin[tile * max_runs];
+				size_t* ends = &run_end[tile * max_runs];
+				size_t& n = runs[tile];
+
+				n = 0;
 
-// Function prototypes
-void idle_func(void);
-void init_opengl(const int& width, const int& height);
-void reshape_func(int width, int height);
-void display_func(void);
-void keyboard_func(unsigned char key, int x, int y);
-void mouse_func(int button, int state, int x, int y);
-void motion_func(int x, int y);
-void passive_motion_func(int x, int y);
+				for (size_t tx = x_begin; tx < x_end; tx += lattice_tile_x_size)
+				{
+					const size_t tx_end = std::min(x_end, tx + lattice_tile_x_size);
+
+					// Skip the tile if the box around it misses every
+					// occupied node of voxel_tree
+					const glm::vec3 tile_size(static_cast<float>(tx_end - 1 - tx), static_cast<float>(ty_end - 1 - ty), static_cast<float>(tz_end - 1 - tz));
+					const glm::vec4 tile_centre = local_min + local_x_step * (tx + tile_size.x * 0.5f) + local_y_step * (ty + tile_size.y * 0.5f) + local_z_step * (tz + tile_size.z * 0.5f);
+
+					lattice_box cells;
+					bool in_grid = true;
+
+					for (int i = 0; i < 3; i++)
+					{
+						const float half_extent = glm::dot(tile_half_step[i], tile_size);
+						const float lo = (tile_centre[i] - half_extent - grid.grid_min[i]) / grid.cell_size;
+						const float hi = (tile_centre[i] + half_extent - grid.grid_min[i]) / grid.cell_size;
+
+						// A cell either way, for the points within rounding of a face
+						cells.min[i] = std::max(0, static_cast<int>(floorf(lo)) - 1);
+						cells.max[i] = std::min(grid.res[i] - 1, static_cast<int>(floorf(hi)) + 1);
+
+						in_grid = in_grid && cells.min[i] <= cells.max[i];
+					}
+
+					if (!in_grid || !voxel_tree.overlaps(cells))
+						continue;
+
+					if (n > 0 && ends[n - 1] == tx)
+						ends[n - 1] = tx_end;
+					else
+					{
+						begins[n] = tx;
+						ends[n] = tx_end;
+						n++;
+					}
+				}
+			}
 
-void draw_objects(void);
-void cleanup(void);
+			// Then go through the rows in order, which keeps the writes to
+			// densities and collisions sequential
+			for (size_t z = tz; z < tz_end; z++)
+			{
+				for (size_t y = y_begin; y < y_end; y++)
+				{
+					const size_t tile = (y - y_begin) / lattice_tile_size;
 
+					if (runs[tile] == 0)
+						continue;
 
-// Global variables
-custom_math::vector_3 background_colour(0.5f, 0.5f, 0.5f);
-custom_math::vector_3 control_list_colour(1.0f, 1.0f, 1.0f);
+					// Start each row from scratch, so that rounding error
+					// does not build up over the whole lattice
+					const glm::vec4 row_origin = local_min + local_y_step * static_cast<float>(y) + local_z_step * static_cast<float>(z);
+					const float origin[3] = { row_origin.x, row_origin.y, row_origin.z };
 
-bool draw_axis = true;
-bool draw_control_list = true;
-bool draw_triangles_on_screen = true;
-uv_camera main_camera;
+					uint64_t* density_row = densities.row(y, z);
+					size_t* collisions_row = &collisions[y * lattice_x_res + z * lattice_x_res * lattice_y_res];
 
-GLint win_id = 0;
-GLint win_x = 800, win_y = 600;
-float camera_w = 10;
+					for (size_t r = 0; r < runs[tile]; r++)
+						classify_row(grid, origin, step, run_begin[tile * max_runs + r], run_end[tile * max_runs + r], density_row, collisions_row);
+				}
+			}
+		}
+	}
 
-float camera_fov = 45;
-float camera_x_transform = 0;
-float camera_y_transform = 0;
-float u_spacer = 0.01f;
-float v_spacer = 0.5f * u_spacer;
-float w_spacer = 0.1f;
-float camera_near = 0.01f;
-float camera_far = 100.0f;
+	voxel_grid_view get_grid_view(void) const
+	{
+		static_assert(brick_map<int32_t>::brick_edge == 8, "get_grid_cell expects 8x8x8 bricks");
+
+		voxel_grid_view grid;
+		grid.grid_min[0] = vo_grid_min.x;
+		grid.grid_min[1] = vo_grid_min.y;
+		grid.grid_min[2] = vo_grid_min.z;
+		grid.cell_size = cell_size;
+		grid.res[0] = static_cast<int>(vo_grid_cells.x_res);
+		grid.res[1] = static_cast<int>(vo_grid_cells.y_res);
+		grid.res[2] = static_cast<int>(vo_grid_cells.z_res);
+		grid.bricks_x = static_cast<int>(vo_grid_cells.bricks_x);
+		grid.bricks_xy = static_cast<int>(vo_grid_cells.bricks_x * vo_grid_cells.bricks_y);
+		grid.bricks = vo_grid_cells.get_brick_index_data();
+		grid.cells = vo_grid_cells.get_cell_data();
+
+		return grid;
+	}
 
-bool lmb_down = false;
-bool mmb_down = false;
-bool rmb_down = false;
-int mouse_x = 0;
-int mouse_y = 0;
+	// Half the size of the axis-aligned box around a box of the given half
+	// size, once it has been transformed by the model matrix
+	static glm::vec3 get_transformed_half_extent(const glm::mat4& model, const glm::vec3& half_size)
+	{
+		glm::vec3 half_extent;
 
+		for (int i = 0; i < 3; i++)
+			half_extent[i] = fabsf(model[0][i]) * half_size.x + fabsf(model[1][i]) * half_size.y + fabsf(model[2][i]) * half_size.z;
 
-vector<unsigned char> test_texture;
+		return half_extent;
+	}
 
-const size_t x_res = 250;
-const size_t y_res = 250;
-const size_t z_res = 250;
+	// Find the box of lattice points that the whole voxel grid may cover,
+	// once it has been transformed by the model matrix.
+	// Returns false if the grid misses the lattice.
+	bool get_grid_lattice_box(
+		const lattice_descriptor& lattice,
+		const glm::mat4& model,
+		lattice_box& b) const
+	{
+		const glm::vec3 grid_min(vo_grid_min.x, vo_grid_min.y, vo_grid_min.z);
+		const glm::vec3 grid_max(vo_grid_max.x, vo_grid_max.y, vo_grid_max.z);
 
-const float x_grid_max = 10;
-const float y_grid_max = 10;
-const float z_grid_max = 10;
+		const glm::vec4 centre = model * glm::vec4((grid_min + grid_max) * 0.5f, 1.0f);
+
+		return lattice.get_box(glm::vec3(centre.x, centre.y, centre.z), get_transformed_half_extent(model, (grid_max - grid_min) * 0.5f), b);
+	}
 
+	// Find the box of lattice points that each solid voxel may cover, once
+	// the voxel has been transformed by the model matrix.
+	// The boxes are a little generous; rasterize_voxel_boxes does the exact test.
+	void get_voxel_lattice_boxes(
+		const lattice_descriptor& lattice,
+		const glm::mat4& model,
+		vector<lattice_box>& boxes) const
+	{
+		boxes.clear();
 
+		// Half the size of the axis-aligned box around a transformed voxel
+		const glm::vec3 half_extent = get_transformed_half_extent(model, glm::vec3(cell_size * 0.5f));
 
+		voxel_densities.for_each_set([&](const size_t x, const size_t y, const size_t z)
+			{
+				const custom_math::position_3 c = get_voxel_centre(x, y, z);
+				const glm::vec4 centre = model * glm::vec4(c.x, c.y, c.z, 1.0f);
 
-class voxel_object
-{
-public:
+				lattice_box b;
 
+				if (lattice.get_box(glm::vec3(centre.x, centre.y, centre.z), half_extent, b))
+					boxes.push_back(b);
+			});
+	}
 
+	// Find the boxes of lattice points that the exposed voxels sweep through
+	// while the model rotates from old_model to new_model.
+	// Every lattice point whose classification can differ between the two
+	// poses is inside one of these boxes.
+	// Returns false if the change is not a small rotation about the origin,
+	// or if the boxes would cover so much of the lattice that a full pass is
+	// just as cheap.
+	bool get_swept_surface_boxes(
+		const lattice_descriptor& lattice,
+		const glm::mat4& old_model,
+		const glm::mat4& new_model,
+		vector<lattice_box>& boxes) const
+	{
+		static const float max_angle = 0.5f;
 
-	custom_math::vertex_3 vo_grid_min;
-	custom_math::vertex_3 vo_grid_max;
-	// 3D array of voxel indices (stores -1 for empty cells)
+		boxes.clear();
 
-	const float cell_size = 1.0;
+		const glm::mat4 delta = new_model * glm::inverse(old_model);
 
-	// Triangles data
-	vector<custom_math::triangle> tri_vec;
-	//custom_math::vertex_3 min_location, max_location;
+		// The change must be a rotation: no translation, and orthonormal
+		if (glm::length(glm::vec3(delta[3][0], delta[3][1], delta[3][2])) > 1e-4f)
+			return false;
 
-	vector<glm::ivec3> voxel_indices;
-	vector<custom_math::vertex_3> voxel_centres;
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++)
+				if (fabsf(glm::dot(glm::vec3(delta[i][0], delta[i][1], delta[i][2]), glm::vec3(delta[j][0], delta[j][1], delta[j][2])) - (i == j ? 1.0f : 0.0f)) > 1e-4f)
+					return false;
 
-	// Note: when destroying a voxel, set voxel_densities[index] to 0 and vo_grid_cells[index] to -1
-	// then re-generate the triangles
-	vector<float> voxel_densities;
-	std::vector<long long signed int> vo_grid_cells;
+		const float cos_angle = std::max(-1.0f, std::min(1.0f, (delta[0][0] + delta[1][1] + delta[2][2] - 1.0f) * 0.5f));
+		const float angle = acosf(cos_angle);
 
+		if (angle > max_angle)
+			return false;
 
+		// A point moving along an arc strays from the chord between the
+		// ends of the arc by at most chord * tan(angle / 4) / 2
+		const float arc_slack = tanf(angle * 0.25f) * 0.5f;
 
-	vector<glm::vec4> voxel_colours;
-	size_t voxel_x_res;
-	size_t voxel_y_res;
-	size_t voxel_z_res;
+		// A voxel is inside this radius of its centre, however it is rotated
+		const float voxel_radius = cell_size * 0.5f * sqrtf(3.0f);
 
-	vector<glm::ivec3> background_indices;
-	vector<custom_math::vertex_3> background_centres;
-	vector<float> background_densities;
-	vector<size_t> background_collisions;
+		const size_t max_volume = lattice.size();
+		size_t volume = 0;
 
-	vector<glm::ivec3> background_surface_indices;
-	vector<custom_math::vertex_3> background_surface_centres;
-	vector<float> background_surface_densities;
-	vector<vector<size_t>> background_surface_collisions;
+		for (size_t z = 0; z < voxel_z_res; z++)
+		{
+			for (size_t y = 0; y < voxel_y_res; y++)
+			{
+				for (size_t x = 0; x < voxel_x_res; x++)
+				{
+					if (!voxel_densities.test(x, y, z))
+						continue;
 
-	glm::mat4 model_matrix = glm::mat4(1.0f);
-	float u = 0.0f, v = 0.0f;
+					// Only the voxels with an exposed face make up the surface.
+					// Note that a neighbour is possibly out of range, which is
+					// why it's tested second.
+					if (x > 0 && voxel_densities.test(x - 1, y, z) &&
+						x + 1 < voxel_x_res && voxel_densities.test(x + 1, y, z) &&
+						y > 0 && voxel_densities.test(x, y - 1, z) &&
+						y + 1 < voxel_y_res && voxel_densities.test(x, y + 1, z) &&
+						z > 0 && voxel_densities.test(x, y, z - 1) &&
+						z + 1 < voxel_z_res && voxel_densities.test(x, y, z + 1))
+					{
+						continue;
+					}
 
+					const custom_math::position_3 c = get_voxel_centre(x, y, z);
 
+					const glm::vec4 old_centre = old_model * glm::vec4(c.x, c.y, c.z, 1.0f);
+					const glm::vec4 new_centre = new_model * glm::vec4(c.x, c.y, c.z, 1.0f);
 
+					const glm::vec3 a(old_centre.x, old_centre.y, old_centre.z);
+					const glm::vec3 b(new_centre.x, new_centre.y, new_centre.z);
 
-	//// Initialize the grid based on voxel data
-	//void initialize(const std::vector<custom_math::vertex_3>& voxel_centres/*,
-	//	const std::vector<float>& voxel_densities*/) {
+					const float radius = voxel_radius + glm::length(b - a) * arc_slack;
 
-	//	// Find min/max extents
-	//	if (voxel_centres.empty()) return;
+					const glm::vec3 box_min = glm::min(a, b) - glm::vec3(radius);
+					const glm::vec3 box_max = glm::max(a, b) + glm::vec3(radius);
 
+					lattice_box box;
 
-	//}
+					if (lattice.get_box((box_min + box_max) * 0.5f, (box_max - box_min) * 0.5f, box))
+					{
+						boxes.push_back(box);
 
+						volume += size_t(box.max[0] - box.min[0] + 1) * (box.max[1] - box.min[1] + 1) * (box.max[2] - box.min[2] + 1);
 
+						if (volume > max_volume)
+							return false;
+					}
+				}
+			}
+		}
 
-	// Find which voxel contains a point
-	bool find_voxel_containing_point(
-		const custom_math::vertex_3& point,
-		size_t& voxel_index) const 
+		return true;
+	}
+
+	// Reclassify the set points of mask, for the z-slab [z_begin, z_end),
+	// leaving the other points as they are
+	void reclassify_lattice_points(
+		const lattice_descriptor& lattice,
+		const occupancy_grid& mask,
+		const size_t z_begin,
+		const size_t z_end,
+		const glm::mat4& model,
+		occupancy_grid& densities,
+		vector<size_t>& collisions) const
 	{
-		// Get grid cell coordinates
-		int cell_x = static_cast<int>((point.x - vo_grid_min.x) / cell_size);
-		int cell_y = static_cast<int>((point.y - vo_grid_min.y) / cell_size);
-		int cell_z = static_cast<int>((point.z - vo_grid_min.z) / cell_size);
+		const glm::mat4 inv_model_matrix = glm::inverse(model);
 
-		// Check bounds
-		if (cell_x < 0 || cell_x >= voxel_x_res ||
-			cell_y < 0 || cell_y >= voxel_y_res ||
-			cell_z < 0 || cell_z >= voxel_z_res) {
-			return false;  // Outside grid
-		}
+		const custom_math::position_3& lattice_min = lattice.lattice_min;
+		const custom_math::position_3& step_size = lattice.step_size;
 
-		// Find the index in the flattened 3D array
-		size_t cell_index = cell_x + (cell_y * voxel_x_res) + (cell_z * voxel_x_res * voxel_y_res);
+		const glm::vec4 local_x_step = inv_model_matrix * glm::vec4(step_size.x, 0.0f, 0.0f, 0.0f);
+		const glm::vec4 local_y_step = inv_model_matrix * glm::vec4(0.0f, step_size.y, 0.0f, 0.0f);
+		const glm::vec4 local_z_step = inv_model_matrix * glm::vec4(0.0f, 0.0f, step_size.z, 0.0f);
+		const glm::vec4 local_min = inv_model_matrix * glm::vec4(lattice_min.x, lattice_min.y, lattice_min.z, 1.0f);
 
-		long long signed int voxel_idx = vo_grid_cells[cell_index];
+		mask.for_each_set(z_begin, z_end, [&](const size_t x, const size_t y, const size_t z)
+			{
+				const glm::vec4 local_point = local_min + local_y_step * static_cast<float>(y) + local_z_step * static_cast<float>(z) + local_x_step * static_cast<float>(x);
 
-		if (voxel_idx == -1)
-			return false;  // No voxel here
+				const custom_math::vertex_3 transformed_point(local_point.x, local_point.y, local_point.z);
 
-		// Do a precise check against the voxel
-		const float half_size = cell_size * 0.5f;
-		const custom_math::vertex_3& center = voxel_centres[voxel_idx];
+				size_t voxel_index = 0;
+
+				if (find_voxel_containing_point(transformed_point, voxel_index))
+				{
+					densities.set(x, y, z);
+					collisions[lattice.index(x, y, z)] = voxel_index;
+				}
+				else
+				{
+					densities.reset(x, y, z);
+				}
+			});
+	}
 
-		if (point.x >= center.x - half_size &&
-			point.x <= center.x + half_size &&
-			point.y >= center.y - half_size &&
-			point.y <= center.y + half_size &&
-			point.z >= center.z - half_size &&
-			point.z <= center.z + half_size)
+	// Inverse rasterization: classify only the lattice points inside the
+	// boxes from get_voxel_lattice_boxes, for the z-slab [z_begin, z_end).
+	// The densities must be cleared beforehand; points outside of every box
+	// are left empty.
+	void rasterize_voxel_boxes(
+		const lattice_descriptor& lattice,
+		const vector<lattice_box>& boxes,
+		const size_t z_begin,
+		const size_t z_end,
+		const glm::mat4& model,
+		occupancy_grid& densities,
+		vector<size_t>& collisions) const
+	{
+		const glm::mat4 inv_model_matrix = glm::inverse(model);
+
+		const custom_math::position_3& lattice_min = lattice.lattice_min;
+		const custom_math::position_3& step_size = lattice.step_size;
+
+		// The steps are directions, so they ignore the translation (w = 0)
+		const glm::vec4 local_x_step = inv_model_matrix * glm::vec4(step_size.x, 0.0f, 0.0f, 0.0f);
+		const glm::vec4 local_y_step = inv_model_matrix * glm::vec4(0.0f, step_size.y, 0.0f, 0.0f);
+		const glm::vec4 local_z_step = inv_model_matrix * glm::vec4(0.0f, 0.0f, step_size.z, 0.0f);
+		const glm::vec4 local_min = inv_model_matrix * glm::vec4(lattice_min.x, lattice_min.y, lattice_min.z, 1.0f);
+
+		for (size_t i = 0; i < boxes.size(); i++)
 		{
-			voxel_index = voxel_idx;
-			return true;
-		}
+			const lattice_box& b = boxes[i];
 
-		return false;
-	}
+			const int z0 = std::max(b.min[2], static_cast<int>(z_begin));
+			const int z1 = std::min(b.max[2], static_cast<int>(z_end) - 1);
 
+			for (int z = z0; z <= z1; z++)
+			{
+				for (int y = b.min[1]; y <= b.max[1]; y++)
+				{
+					glm::vec4 local_point = local_min + local_y_step * static_cast<float>(y) + local_z_step * static_cast<float>(z) + local_x_step * static_cast<float>(b.min[0]);
 
-	// Combine the grid with the model transformation
-	bool is_point_in_voxel_grid(const custom_math::vertex_3& test_point,
-		const glm::mat4& model,
-		size_t& voxel_index,
-		voxel_object& v) {
-		// 1. Calculate the inverse model matrix
-		glm::mat4 inv_model_matrix = glm::inverse(model);
+					size_t index = lattice.index(b.min[0], y, z);
 
-		// 2. Transform the test point with the inverse model matrix
-		glm::vec4 model_space_point(test_point.x, test_point.y, test_point.z, 1.0f);
-		glm::vec4 local_space_point = inv_model_matrix * model_space_point;
+					for (int x = b.min[0]; x <= b.max[0]; x++, index++, local_point += local_x_step)
+					{
+						size_t voxel_index = 0;
 
-		// 3. Create a vertex_3 from the transformed point
-		custom_math::vertex_3 transformed_point(
-			local_space_point.x,
-			local_space_point.y,
-			local_space_point.z
-		);
+						const custom_math::vertex_3 transformed_point(local_point.x, local_point.y, local_point.z);
 
-		// 4. Use the grid to find the voxel
-		return find_voxel_containing_point(transformed_point, voxel_index);
+						if (find_voxel_containing_point(transformed_point, voxel_index))
+						{
+							densities.set(x, y, z);
+							collisions[index] = voxel_index;
+						}
+					}
+				}
+			}
+		}
 	}
 
 
@@ -293,36 +1959,34 @@ void centre_voxels_on_xyz(voxel_object &v)
 	float y_max = -numeric_limits<float>::max();
 	float z_max = -numeric_limits<float>::max();
 
-	for (size_t t = 0; t < v.voxel_centres.size(); t++)
-	{
-		if (v.voxel_densities[t] == 0)
-			continue;
+	v.voxel_offset = custom_math::position_3(0.0f, 0.0f, 0.0f);
 
-		if (v.voxel_centres[t].x < x_min)
-			x_min = v.voxel_centres[t].x;
+	v.voxel_densities.for_each_set([&](const size_t x, const size_t y, const size_t z)
+		{
+			const custom_math::position_3 c = v.get_voxel_centre(x, y, z);
 
-		if (v.voxel_centres[t].x > x_max)
-			x_max = v.voxel_centres[t].x;
+			if (c.x < x_min)
+				x_min = c.x;
 
-		if (v.voxel_centres[t].y < y_min)
-			y_min = v.voxel_centres[t].y;
+			if (c.x > x_max)
+				x_max = c.x;
 
-		if (v.voxel_centres[t].y > y_max)
-			y_max = v.voxel_centres[t].y;
+			if (c.y < y_min)
+				y_min = c.y;
 
-		if (v.voxel_centres[t].z < z_min)
-			z_min = v.voxel_centres[t].z;
+			if (c.y > y_max)
+				y_max = c.y;
 
-		if (v.voxel_centres[t].z > z_max)
-			z_max = v.voxel_centres[t].z;
-	}
+			if (c.z < z_min)
+				z_min = c.z;
 
-	for (size_t t = 0; t < v.voxel_centres.size(); t++)
-	{
-		v.voxel_centres[t].x += -(x_max + x_min) / 2.0f;
-		v.voxel_centres[t].y += -(y_max + y_min) / 2.0f;
-		v.voxel_centres[t].z += -(z_max + z_min) / 2.0f;
-	}
+			if (c.z > z_max)
+				z_max = c.z;
+		});
+
+	v.voxel_offset.x = -(x_max + x_min) / 2.0f;
+	v.voxel_offset.y = -(y_max + y_min) / 2.0f;
+	v.voxel_offset.z = -(z_max + z_min) / 2.0f;
 }
 
 
@@ -393,54 +2057,241 @@ bool write_triangles_to_binary_stereo_lithography_file(const vector<custom_math:
 	return true;
 }
 
+bool write_triangles_to_binary_stereo_lithography_file(const indexed_mesh& mesh, const char* const file_name)
+{
+	cout << "Triangle count: " << mesh.size() << endl;
+
+	if (0 == mesh.size())
+		return false;
+
+	// Write to file.
+	ofstream out(file_name, ios_base::binary);
+
+	if (out.fail())
+		return false;
+
+	const size_t header_size = 80;
+	vector<char> buffer(header_size, 0);
+	const unsigned int num_triangles = static_cast<unsigned int>(mesh.size()); // Must be 4-byte unsigned int.
+	custom_math::vertex_3 normal;
+
+	// Write blank header.
+	out.write(reinterpret_cast<const char*>(&(buffer[0])), header_size);
+
+	// Write number of triangles.
+	out.write(reinterpret_cast<const char*>(&num_triangles), sizeof(unsigned int));
+
+	// Copy everything to a single buffer.
+	cout << "Generating normal/vertex/attribute buffer" << endl;
+
+	// Enough bytes for twelve 4-byte floats plus one 2-byte integer, per triangle.
+	const size_t data_size = (12 * sizeof(float) + sizeof(short unsigned int)) * num_triangles;
+	buffer.resize(data_size, 0);
+
+	// Use a pointer to assist with the copying.
+	char* cp = &buffer[0];
+
+	for (size_t i = 0; i < mesh.indices.size(); i += 3)
+	{
+		const Vertex& a = mesh.vertices[mesh.indices[i + 0]];
+		const Vertex& b = mesh.vertices[mesh.indices[i + 1]];
+		const Vertex& c = mesh.vertices[mesh.indices[i + 2]];
+
+		// Get face normal.
+		custom_math::vertex_3 v0(b.position[0] - a.position[0], b.position[1] - a.position[1], b.position[2] - a.position[2]);
+		custom_math::vertex_3 v1(c.position[0] - a.position[0], c.position[1] - a.position[1], c.position[2] - a.position[2]);
+		normal = v0.cross(v1);
+		normal.normalize();
+
+		memcpy(cp, &normal.x, sizeof(float)); cp += sizeof(float);
+		memcpy(cp, &normal.y, sizeof(float)); cp += sizeof(float);
+		memcpy(cp, &normal.z, sizeof(float)); cp += sizeof(float);
+
+		memcpy(cp, a.position, 3 * sizeof(float)); cp += 3 * sizeof(float);
+		memcpy(cp, b.position, 3 * sizeof(float)); cp += 3 * sizeof(float);
+		memcpy(cp, c.position, 3 * sizeof(float)); cp += 3 * sizeof(float);
+
+		cp += sizeof(short unsigned int);
+	}
+
+	cout << "Writing " << data_size / 1048576.0f << " MB of data to binary Stereo Lithography file: " << file_name << endl;
+
+	out.write(reinterpret_cast<const char*>(&buffer[0]), data_size);
+	out.close();
+
+	return true;
+}
+
+
+
+// A read-only view of a whole file, mapped into memory rather than read
+// into a buffer. The pages are only read from disk as they are touched.
+class mapped_file
+{
+public:
+	mapped_file(void)
+	{
+	}
+
+	~mapped_file(void)
+	{
+		close();
+	}
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	// Returns false if the file can't be opened, or is empty
+	bool open(const char* file_name)
+	{
+		close();
+
+#ifdef _WIN32
+		HANDLE file = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER file_size;
+
+		if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+		{
+			CloseHandle(file);
+			return false;
+		}
+
+		// The view keeps the mapping alive, and the mapping keeps the file open
+		HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+		CloseHandle(file);
+
+		if (mapping == 0)
+			return false;
+
+		const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping);
+
+		if (view == 0)
+			return false;
+
+		bytes = static_cast<const uint8_t*>(view);
+		byte_count = static_cast<size_t>(file_size.QuadPart);
+#else
+		const int fd = ::open(file_name, O_RDONLY);
+
+		if (fd == -1)
+			return false;
+
+		struct stat file_stat;
+
+		if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0)
+		{
+			::close(fd);
+			return false;
+		}
+
+		// The mapping stays valid after the descriptor is closed
+		void* view = mmap(0, static_cast<size_t>(file_stat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+
+		if (view == MAP_FAILED)
+			return false;
+
+		madvise(view, static_cast<size_t>(file_stat.st_size), MADV_SEQUENTIAL);
+
+		bytes = static_cast<const uint8_t*>(view);
+		byte_count = static_cast<size_t>(file_stat.st_size);
+#endif
+
+		return true;
+	}
+
+	void close(void)
+	{
+		if (bytes == 0)
+			return;
+
+#ifdef _WIN32
+		UnmapViewOfFile(bytes);
+#else
+		munmap(const_cast<uint8_t*>(bytes), byte_count);
+#endif
+
+		bytes = 0;
+		byte_count = 0;
+	}
+
+	const uint8_t* data(void) const
+	{
+		return bytes;
+	}
+
+	size_t size(void) const
+	{
+		return byte_count;
+	}
 
+private:
+	const uint8_t* bytes = 0;
+	size_t byte_count = 0;
+};
 
-bool get_voxels(const char* file_name, voxel_object& v)
-{
-	v.voxel_indices.clear();
-	v.voxel_centres.clear();
-	v.voxel_densities.clear();
-	v.voxel_colours.clear();
-	v.vo_grid_cells.clear();
 
-	ifstream infile(file_name, ifstream::ate | ifstream::binary);
+// Returns 0 on failure, otherwise the caller destroys the scene
+const ogt_vox_scene* read_vox_scene(const char* file_name, const uint32_t read_flags)
+{
+	// The parser works straight from the mapped pages, including the
+	// XYZI voxel payloads, so the file is never copied into a buffer
+	mapped_file f;
 
-	if (infile.fail())
+	if (!f.open(file_name))
 	{
 		cout << "Could not open file " << file_name << endl;
-		return false;
+		return 0;
 	}
 
-	size_t file_size = infile.tellg();
+	if (f.size() > UINT32_MAX)
+	{
+		cout << "File too large: " << file_name << endl;
+		return 0;
+	}
 
-	infile.close();
+	// The scene owns copies of everything it needs, so the mapping is
+	// closed when f goes out of scope
+	const ogt_vox_scene* scene = ogt_vox_read_scene_with_flags(f.data(), static_cast<uint32_t>(f.size()), read_flags);
 
-	if (file_size == 0)
-		return false;
+	if (scene == 0 || scene->num_models == 0)
+	{
+		cout << "Could not read voxel model from " << file_name << endl;
 
-	infile.open(file_name, ifstream::binary);
+		if (scene != 0)
+			ogt_vox_destroy_scene(scene);
 
-	if (infile.fail())
-	{
-		return false;
+		return 0;
 	}
 
-	vector<unsigned char> f(file_size, 0);
+	return scene;
+}
+
 
-	infile.read(reinterpret_cast<char*>(&f[0]), file_size);
-	infile.close();
+// Builds v from one model of a scene
+bool get_voxels(const ogt_vox_model& model, const ogt_vox_palette& palette, voxel_object& v)
+{
+	v.voxel_densities.clear();
+	v.voxel_colours.clear();
+	v.vo_grid_cells.clear();
+	v.voxel_tree.clear();
+	v.voxel_x_res = v.voxel_y_res = v.voxel_z_res = 0;
+	v.background_sampled = false;
 
-	const ogt_vox_scene* scene = ogt_vox_read_scene(&f[0], static_cast<uint32_t>(file_size));
+	if (model.size_x == 0 || model.size_y == 0 || model.size_z == 0)
+		return false;
 
-	v.voxel_x_res = scene->models[0]->size_x;
-	v.voxel_y_res = scene->models[0]->size_y;
-	v.voxel_z_res = scene->models[0]->size_z;
+	v.voxel_x_res = model.size_x;
+	v.voxel_y_res = model.size_y;
+	v.voxel_z_res = model.size_z;
 
-	v.voxel_indices.resize(v.voxel_x_res * v.voxel_y_res * v.voxel_z_res);
-	v.voxel_centres.resize(v.voxel_x_res * v.voxel_y_res * v.voxel_z_res);
-	v.voxel_densities.resize(v.voxel_x_res * v.voxel_y_res * v.voxel_z_res);
-	v.voxel_colours.resize(v.voxel_x_res * v.voxel_y_res * v.voxel_z_res);
-	v.vo_grid_cells.resize(v.voxel_x_res * v.voxel_y_res * v.voxel_z_res);
+	v.voxel_densities.resize(v.voxel_x_res, v.voxel_y_res, v.voxel_z_res);
+	v.voxel_colours.resize(v.voxel_x_res, v.voxel_y_res, v.voxel_z_res, glm::vec4(0.0f));
 
 	for (size_t x = 0; x < v.voxel_x_res; x++)
 	{
@@ -449,54 +2300,40 @@ bool get_voxels(const char* file_name, voxel_object& v)
 			for (size_t z = 0; z < v.voxel_z_res; z++)
 			{
 				const size_t voxel_index = x + (y * v.voxel_x_res) + (z * v.voxel_x_res * v.voxel_y_res);
-				const uint8_t colour_index = scene->models[0]->voxel_data[voxel_index];
-
-				custom_math::vertex_3 translate(x * v.cell_size, y * v.cell_size, z * v.cell_size);
-
-				v.voxel_centres[voxel_index] = translate;
-				v.voxel_indices[voxel_index] = glm::ivec3(x, y, z);
+				const uint8_t colour_index = model.voxel_data[voxel_index];
 
 				// Transparent
 				if (colour_index == 0)
-				{
-					v.voxel_densities[voxel_index] = 0.0;
-					v.vo_grid_cells[voxel_index] = -1;
 					continue;
-				}
-				else
-				{
-					v.voxel_densities[voxel_index] = 1.0;
-					v.vo_grid_cells[voxel_index] = 0;
-				}
 
-				const ogt_vox_rgba colour = scene->palette.color[colour_index];
+				v.voxel_densities.set(x, y, z);
+
+				const ogt_vox_rgba colour = palette.color[colour_index];
 
 				uint8_t r = colour.r;
 				uint8_t g = colour.g;
 				uint8_t b = colour.b;
 				uint8_t a = colour.a;
 
-				v.voxel_colours[voxel_index] = glm::vec4(r / 255.0f, g / 255.0f, b / 255.0f, a / 255.0f);
+				v.voxel_colours.at(x, y, z) = glm::vec4(r / 255.0f, g / 255.0f, b / 255.0f, a / 255.0f);
 			}
 		}
 	}
 
-	ogt_vox_destroy_scene(scene);
-
-	for (size_t i = 0; i < v.voxel_centres.size(); i++)
-	{
-		static const float pi = 4.0f * atanf(1.0f);
-		v.voxel_centres[i].rotate_x(pi - pi / 2.0f);
-	}
-
 	centre_voxels_on_xyz(v);
 
+	v.vo_grid_min = v.get_voxel_centre(0, 0, 0);
+	v.vo_grid_max = v.vo_grid_min;
 
-	v.vo_grid_min = v.voxel_centres[0];
-	v.vo_grid_max = v.voxel_centres[0];
-
-	for (const auto& center : v.voxel_centres)
+	// The centres are an affine function of (x, y, z), so the extremes
+	// are at the corners of the grid
+	for (size_t corner = 0; corner < 8; corner++)
 	{
+		const custom_math::position_3 center = v.get_voxel_centre(
+			(corner & 1) ? v.voxel_x_res - 1 : 0,
+			(corner & 2) ? v.voxel_y_res - 1 : 0,
+			(corner & 4) ? v.voxel_z_res - 1 : 0);
+
 		v.vo_grid_min.x = std::min(v.vo_grid_min.x, center.x - v.cell_size / 2.0f);
 		v.vo_grid_min.y = std::min(v.vo_grid_min.y, center.y - v.cell_size / 2.0f);
 		v.vo_grid_min.z = std::min(v.vo_grid_min.z, center.z - v.cell_size / 2.0f);
@@ -506,33 +2343,183 @@ bool get_voxels(const char* file_name, voxel_object& v)
 		v.vo_grid_max.z = std::max(v.vo_grid_max.z, center.z + v.cell_size / 2.0f);
 	}
 
-	// Calculate grid dimensions
+	// Calculate grid dimensions. The rotation swaps y and z, so these
+	// are not voxel_x_res, voxel_y_res and voxel_z_res.
 	float size_x = v.vo_grid_max.x - v.vo_grid_min.x;
 	float size_y = v.vo_grid_max.y - v.vo_grid_min.y;
 	float size_z = v.vo_grid_max.z - v.vo_grid_min.z;
 
+	const size_t grid_x_res = std::max(1L, lroundf(size_x / v.cell_size));
+	const size_t grid_y_res = std::max(1L, lroundf(size_y / v.cell_size));
+	const size_t grid_z_res = std::max(1L, lroundf(size_z / v.cell_size));
+
+	v.vo_grid_cells.resize(grid_x_res, grid_y_res, grid_z_res, -1);
+
+	occupancy_grid grid_occupancy;
+	grid_occupancy.resize(grid_x_res, grid_y_res, grid_z_res);
+
 	// Place voxels in the grid
-	for (size_t i = 0; i < v.voxel_centres.size(); i++)
+	v.voxel_densities.for_each_set([&](const size_t x, const size_t y, const size_t z)
+		{
+			const custom_math::position_3 center = v.get_voxel_centre(x, y, z);
+
+			// Get grid cell coordinates
+			size_t cell_x = static_cast<int>((center.x - v.vo_grid_min.x) / v.cell_size);
+			size_t cell_y = static_cast<int>((center.y - v.vo_grid_min.y) / v.cell_size);
+			size_t cell_z = static_cast<int>((center.z - v.vo_grid_min.z) / v.cell_size);
+
+			// Ensure within bounds
+			cell_x = std::max((size_t)0, std::min(cell_x, grid_x_res - 1));
+			cell_y = std::max((size_t)0, std::min(cell_y, grid_y_res - 1));
+			cell_z = std::max((size_t)0, std::min(cell_z, grid_z_res - 1));
+
+			// Store voxel index in the grid
+			v.vo_grid_cells.at(cell_x, cell_y, cell_z) = static_cast<int32_t>(x + (y * v.voxel_x_res) + (z * v.voxel_x_res * v.voxel_y_res));
+			grid_occupancy.set(cell_x, cell_y, cell_z);
+		});
+
+	v.voxel_tree.build(grid_occupancy);
+
+	return true;
+}
+
+bool get_voxels(const char* file_name, voxel_object& v)
+{
+	const ogt_vox_scene* scene = read_vox_scene(file_name, 0);
+
+	if (scene == 0)
+		return false;
+
+	const bool result = get_voxels(*scene->models[0], scene->palette, v);
+
+	ogt_vox_destroy_scene(scene);
+
+	return result;
+}
+
+
+// The matrix that places an object built by get_voxels from the instance's
+// model where MagicaVoxel puts the instance, in the same rotated frame
+glm::mat4 get_instance_model_matrix(const ogt_vox_scene& scene, const ogt_vox_instance& instance, const voxel_object& v)
+{
+	const ogt_vox_transform t = ogt_vox_sample_instance_transform(&instance, 0, &scene);
+	const glm::mat4 instance_matrix = glm::make_mat4(&t.m00);
+
+	// The rotation that get_voxel_centre applies: y' = z, z' = -y
+	const glm::mat4 rotation(
+		1.0f, 0.0f, 0.0f, 0.0f,
+		0.0f, 0.0f, -1.0f, 0.0f,
+		0.0f, 1.0f, 0.0f, 0.0f,
+		0.0f, 0.0f, 0.0f, 1.0f);
+
+	// MagicaVoxel puts voxel p at p + 0.5 - pivot in model space, where the
+	// pivot is the middle of the model rounded down
+	const glm::vec3 pivot(
+		static_cast<float>(v.voxel_x_res / 2),
+		static_cast<float>(v.voxel_y_res / 2),
+		static_cast<float>(v.voxel_z_res / 2));
+
+	// Undo get_voxel_centre, to get back to voxel coordinates
+	glm::mat4 to_voxel = glm::scale(glm::mat4(1.0f), glm::vec3(1.0f / v.cell_size));
+	to_voxel = to_voxel * glm::transpose(rotation);
+	to_voxel = glm::translate(to_voxel, glm::vec3(-v.voxel_offset.x, -v.voxel_offset.y, -v.voxel_offset.z));
+
+	const glm::mat4 to_model = glm::translate(glm::mat4(1.0f), glm::vec3(0.5f) - pivot);
+
+	return rotation * glm::scale(glm::mat4(1.0f), glm::vec3(v.cell_size)) * instance_matrix * to_model * to_voxel;
+}
+
+
+// Whether the instance, its layer or any group above it is hidden
+bool is_instance_hidden(const ogt_vox_scene& scene, const ogt_vox_instance& instance)
+{
+	if (instance.hidden)
+		return true;
+
+	if (instance.layer_index < scene.num_layers && scene.layers[instance.layer_index].hidden)
+		return true;
+
+	for (uint32_t g = instance.group_index; g != k_invalid_group_index && g < scene.num_groups; g = scene.groups[g].parent_group_index)
+		if (scene.groups[g].hidden)
+			return true;
+
+	return false;
+}
+
+
+// One object per visible instance in the scene, with model_matrix set to
+// the instance's transform. Instances of the same model share their
+// colours and grid cells (see brick_map), so only the small per-instance
+// parts are copied.
+bool get_voxel_scene(const char* file_name, vector<voxel_object>& objects)
+{
+	objects.clear();
+
+	const ogt_vox_scene* scene = read_vox_scene(file_name, k_read_scene_flags_groups);
+
+	if (scene == 0)
+		return false;
+
+	// The parser already merges identical models, but check anyway, by
+	// hash first and then by content
+	vector<voxel_object> prototypes;
+	vector<size_t> model_prototypes(scene->num_models, SIZE_MAX);
+	unordered_map<uint32_t, vector<uint32_t> > models_by_hash;
+
+	for (uint32_t i = 0; i < scene->num_instances; i++)
 	{
-		if (v.voxel_densities[i] <= 0.0f) continue;
+		const ogt_vox_instance& instance = scene->instances[i];
 
-		const auto& center = v.voxel_centres[i];
+		if (is_instance_hidden(*scene, instance))
+			continue;
 
-		// Get grid cell coordinates
-		size_t cell_x = static_cast<int>((center.x - v.vo_grid_min.x) / v.cell_size);
-		size_t cell_y = static_cast<int>((center.y - v.vo_grid_min.y) / v.cell_size);
-		size_t cell_z = static_cast<int>((center.z - v.vo_grid_min.z) / v.cell_size);
+		const uint32_t model_index = ogt_vox_sample_instance_model(&instance, 0);
+
+		if (model_index >= scene->num_models || scene->models[model_index] == 0)
+			continue;
+
+		if (model_prototypes[model_index] == SIZE_MAX)
+		{
+			const ogt_vox_model& model = *scene->models[model_index];
+			vector<uint32_t>& same_hash = models_by_hash[model.voxel_hash];
+
+			for (size_t j = 0; j < same_hash.size(); j++)
+			{
+				const ogt_vox_model& other = *scene->models[same_hash[j]];
+
+				if (other.size_x == model.size_x && other.size_y == model.size_y && other.size_z == model.size_z &&
+					memcmp(other.voxel_data, model.voxel_data, size_t(model.size_x) * model.size_y * model.size_z) == 0)
+				{
+					model_prototypes[model_index] = model_prototypes[same_hash[j]];
+					break;
+				}
+			}
+
+			if (model_prototypes[model_index] == SIZE_MAX)
+			{
+				prototypes.emplace_back();
+
+				if (false == get_voxels(model, scene->palette, prototypes.back()))
+				{
+					prototypes.pop_back();
+					continue;
+				}
+
+				model_prototypes[model_index] = prototypes.size() - 1;
+				same_hash.push_back(model_index);
+			}
+		}
 
-		// Ensure within bounds
-		cell_x = std::max((size_t)0, std::min(cell_x, v.voxel_x_res - 1));
-		cell_y = std::max((size_t)0, std::min(cell_y, v.voxel_y_res - 1));
-		cell_z = std::max((size_t)0, std::min(cell_z, v.voxel_z_res - 1));
+		objects.push_back(prototypes[model_prototypes[model_index]]);
+		objects.back().model_matrix = get_instance_model_matrix(*scene, instance, objects.back());
+	}
 
-		// Get index in the flattened 3D array
-		size_t cell_index = cell_x + (cell_y * v.voxel_x_res) + (cell_z * v.voxel_x_res * v.voxel_y_res);
+	ogt_vox_destroy_scene(scene);
 
-		// Store voxel index in the grid
-		v.vo_grid_cells[cell_index] = static_cast<int>(i);
+	if (objects.empty())
+	{
+		cout << "No visible instances in " << file_name << endl;
+		return false;
 	}
 
 	return true;
@@ -541,15 +2528,23 @@ bool get_voxels(const char* file_name, voxel_object& v)
 
 
 
-bool get_triangles(vector<custom_math::triangle>& tri_vec, voxel_object& v)
+// T is either vector<custom_math::triangle> or indexed_mesh
+template<class T>
+bool get_triangles(T& tri_vec, voxel_object& v)
 {
 	tri_vec.clear();
 
-	for (size_t i = 0; i < v.voxel_centres.size(); i++)
+	static const float pi = 4.0f * atanf(1.0f);
+
+	// Rotate each triangle back into place as it is added
+	const auto add_triangle = [&](custom_math::triangle t)
 	{
-		static const float pi = 4.0f * atanf(1.0f);
-		v.voxel_centres[i].rotate_x(-(pi - pi / 2.0f));
-	}
+		t.vertex[0].rotate_x(pi - pi / 2.0f);
+		t.vertex[1].rotate_x(pi - pi / 2.0f);
+		t.vertex[2].rotate_x(pi - pi / 2.0f);
+
+		tri_vec.push_back(t);
+	};
 
 	for (size_t x = 0; x < v.voxel_x_res; x++)
 	{
@@ -557,159 +2552,150 @@ bool get_triangles(vector<custom_math::triangle>& tri_vec, voxel_object& v)
 		{
 			for (size_t z = 0; z < v.voxel_z_res; z++)
 			{
-				const size_t voxel_index = x + (y * v.voxel_x_res) + (z * v.voxel_x_res * v.voxel_y_res);
-				const custom_math::vertex_3 translate = v.voxel_centres[voxel_index];
-
-				v.voxel_indices[voxel_index] = glm::ivec3(x, y, z);
-
-				if (0 == v.voxel_densities[voxel_index])
+				if (!v.voxel_densities.test(x, y, z))
 					continue;
 
+				// Build the faces before the rotation that get_voxels applies
+				custom_math::position_3 translate = v.get_voxel_centre(x, y, z);
+				translate.rotate_x(-(pi - pi / 2.0f));
+
 				custom_math::quad q0, q1, q2, q3, q4, q5;
 
 				// Top face (y = 1.0f)
-				q0.vertex[0] = custom_math::vertex_3(v.cell_size * 0.5f, v.cell_size * 0.5f, -v.cell_size * 0.5f) + translate;
-				q0.vertex[1] = custom_math::vertex_3(-v.cell_size * 0.5f, v.cell_size * 0.5f, -v.cell_size * 0.5f) + translate;
-				q0.vertex[2] = custom_math::vertex_3(-v.cell_size * 0.5f, v.cell_size * 0.5f, v.cell_size * 0.5f) + translate;
-				q0.vertex[3] = custom_math::vertex_3(v.cell_size * 0.5f, v.cell_size * 0.5f, v.cell_size * 0.5f) + translate;
+				q0.vertex[0] = custom_math::position_3(v.cell_size * 0.5f, v.cell_size * 0.5f, -v.cell_size * 0.5f) + translate;
+				q0.vertex[1] = custom_math::position_3(-v.cell_size * 0.5f, v.cell_size * 0.5f, -v.cell_size * 0.5f) + translate;
+				q0.vertex[2] = custom_math::position_3(-v.cell_size * 0.5f, v.cell_size * 0.5f, v.cell_size * 0.5f) + translate;
+				q0.vertex[3] = custom_math::position_3(v.cell_size * 0.5f, v.cell_size * 0.5f, v.cell_size * 0.5f) + translate;
 
 				// Bottom face (y = -v.cell_size*0.5f)
-				q1.vertex[0] = custom_math::vertex_3(v.cell_size * 0.5f, -v.cell_size * 0.5f, v.cell_size * 0.5f) + translate;
-				q1.vertex[1] = custom_math::vertex_3(-v.cell_size * 0.5f, -v.cell_size * 0.5f, v.cell_size * 0.5f) + translate;
-				q1.vertex[2] = custom_math::vertex_3(-v.cell_size * 0.5f, -v.cell_size * 0.5f, -v.cell_size * 0.5f) + translate;
-				q1.vertex[3] = custom_math::vertex_3(v.cell_size * 0.5f, -v.cell_size * 0.5f, -v.cell_size * 0.5f) + translate;
+				q1.vertex[0] = custom_math::position_3(v.cell_size * 0.5f, -v.cell_size * 0.5f, v.cell_size * 0.5f) + translate;
+				q1.vertex[1] = custom_math::position_3(-v.cell_size * 0.5f, -v.cell_size * 0.5f, v.cell_size * 0.5f) + translate;
+				q1.vertex[2] = custom_math::position_3(-v.cell_size * 0.5f, -v.cell_size * 0.5f, -v.cell_size * 0.5f) + translate;
+				q1.vertex[3] = custom_math::position_3(v.cell_size * 0.5f, -v.cell_size * 0.5f, -v.cell_size * 0.5f) + translate;
 
 				// Front face  (z = v.cell_size*0.5f)
-				q2.vertex[0] = custom_math::vertex_3(v.cell_size * 0.5f, v.cell_size * 0.5f, v.cell_size * 0.5f) + translate;
-				q2.vertex[1] = custom_math::vertex_3(-v.cell_size * 0.5f, v.cell_size * 0.5f, v.cell_size * 0.5f) + translate;
-				q2.vertex[2] = custom_math::vertex_3(-v.cell_size * 0.5f, -v.cell_size * 0.5f, v.cell_size * 0.5f) + translate;
-				q2.vertex[3] = custom_math::vertex_3(v.cell_size * 0.5f, -v.cell_size * 0.5f, v.cell_size * 0.5f) + translate;
+				q2.vertex[0] = custom_math::position_3(v.cell_size * 0.5f, v.cell_size * 0.5f, v.cell_size * 0.5f) + translate;
+				q2.vertex[1] = custom_math::position_3(-v.cell_size * 0.5f, v.cell_size * 0.5f, v.cell_size * 0.5f) + translate;
+				q2.vertex[2] = custom_math::position_3(-v.cell_size * 0.5f, -v.cell_size * 0.5f, v.cell_size * 0.5f) + translate;
+				q2.vertex[3] = custom_math::position_3(v.cell_size * 0.5f, -v.cell_size * 0.5f, v.cell_size * 0.5f) + translate;
 
 				// Back face (z = -v.cell_size*0.5f)
-				q3.vertex[0] = custom_math::vertex_3(v.cell_size * 0.5f, -v.cell_size * 0.5f, -v.cell_size * 0.5f) + translate;
-				q3.vertex[1] = custom_math::vertex_3(-v.cell_size * 0.5f, -v.cell_size * 0.5f, -v.cell_size * 0.5f) + translate;
-				q3.vertex[2] = custom_math::vertex_3(-v.cell_size * 0.5f, v.cell_size * 0.5f, -v.cell_size * 0.5f) + translate;
-				q3.vertex[3] = custom_math::vertex_3(v.cell_size * 0.5f, v.cell_size * 0.5f, -v.cell_size * 0.5f) + translate;
+				q3.vertex[0] = custom_math::position_3(v.cell_size * 0.5f, -v.cell_size * 0.5f, -v.cell_size * 0.5f) + translate;
+				q3.vertex[1] = custom_math::position_3(-v.cell_size * 0.5f, -v.cell_size * 0.5f, -v.cell_size * 0.5f) + translate;
+				q3.vertex[2] = custom_math::position_3(-v.cell_size * 0.5f, v.cell_size * 0.5f, -v.cell_size * 0.5f) + translate;
+				q3.vertex[3] = custom_math::position_3(v.cell_size * 0.5f, v.cell_size * 0.5f, -v.cell_size * 0.5f) + translate;
 
 				// Right face (x = v.cell_size*0.5f)
-				q4.vertex[0] = custom_math::vertex_3(v.cell_size * 0.5f, v.cell_size * 0.5f, -v.cell_size * 0.5f) + translate;
-				q4.vertex[1] = custom_math::vertex_3(v.cell_size * 0.5f, v.cell_size * 0.5f, v.cell_size * 0.5f) + translate;
-				q4.vertex[2] = custom_math::vertex_3(v.cell_size * 0.5f, -v.cell_size * 0.5f, v.cell_size * 0.5f) + translate;
-				q4.vertex[3] = custom_math::vertex_3(v.cell_size * 0.5f, -v.cell_size * 0.5f, -v.cell_size * 0.5f) + translate;
+				q4.vertex[0] = custom_math::position_3(v.cell_size * 0.5f, v.cell_size * 0.5f, -v.cell_size * 0.5f) + translate;
+				q4.vertex[1] = custom_math::position_3(v.cell_size * 0.5f, v.cell_size * 0.5f, v.cell_size * 0.5f) + translate;
+				q4.vertex[2] = custom_math::position_3(v.cell_size * 0.5f, -v.cell_size * 0.5f, v.cell_size * 0.5f) + translate;
+				q4.vertex[3] = custom_math::position_3(v.cell_size * 0.5f, -v.cell_size * 0.5f, -v.cell_size * 0.5f) + translate;
 
 				// Left face (x = -v.cell_size*0.5f)
-				q5.vertex[0] = custom_math::vertex_3(-v.cell_size * 0.5f, v.cell_size * 0.5f, v.cell_size * 0.5f) + translate;
-				q5.vertex[1] = custom_math::vertex_3(-v.cell_size * 0.5f, v.cell_size * 0.5f, -v.cell_size * 0.5f) + translate;
-				q5.vertex[2] = custom_math::vertex_3(-v.cell_size * 0.5f, -v.cell_size * 0.5f, -v.cell_size * 0.5f) + translate;
-				q5.vertex[3] = custom_math::vertex_3(-v.cell_size * 0.5f, -v.cell_size * 0.5f, v.cell_size * 0.5f) + translate;
+				q5.vertex[0] = custom_math::position_3(-v.cell_size * 0.5f, v.cell_size * 0.5f, v.cell_size * 0.5f) + translate;
+				q5.vertex[1] = custom_math::position_3(-v.cell_size * 0.5f, v.cell_size * 0.5f, -v.cell_size * 0.5f) + translate;
+				q5.vertex[2] = custom_math::position_3(-v.cell_size * 0.5f, -v.cell_size * 0.5f, -v.cell_size * 0.5f) + translate;
+				q5.vertex[3] = custom_math::position_3(-v.cell_size * 0.5f, -v.cell_size * 0.5f, v.cell_size * 0.5f) + translate;
 
 				custom_math::triangle t;
 
-				const glm::vec4 c = v.voxel_colours[voxel_index];
+				const glm::vec4 c = v.voxel_colours.get(x, y, z);
 				t.colour.x = c.r;
 				t.colour.y = c.g;
 				t.colour.z = c.b;
 
-				size_t neighbour_index = 0;
-
-				// Note that this index is possibly out of range, 
-				// which is why it's used second in the if()
-				neighbour_index = x + (y + 1) * v.voxel_x_res + z * v.voxel_x_res * v.voxel_y_res;
-				if (y == v.voxel_y_res - 1 || 0 == v.voxel_densities[neighbour_index])
+				// Note that this neighbour is possibly out of range, 
+				// which is why it's tested second in the if()
+				if (y == v.voxel_y_res - 1 || !v.voxel_densities.test(x, y + 1, z))
 				{
 					t.vertex[0] = q0.vertex[0];
 					t.vertex[1] = q0.vertex[1];
 					t.vertex[2] = q0.vertex[2];
 
-					tri_vec.push_back(t);
+					add_triangle(t);
 
 					t.vertex[0] = q0.vertex[0];
 					t.vertex[1] = q0.vertex[2];
 					t.vertex[2] = q0.vertex[3];
-					tri_vec.push_back(t);
+					add_triangle(t);
 				}
 
-				// Note that this index is possibly out of range, 
-				// which is why it's used second in the if()
-				neighbour_index = x + (y - 1) * v.voxel_x_res + z * v.voxel_x_res * v.voxel_y_res;
-				if (y == 0 || 0 == v.voxel_densities[neighbour_index])
+				// Note that this neighbour is possibly out of range, 
+				// which is why it's tested second in the if()
+				if (y == 0 || !v.voxel_densities.test(x, y - 1, z))
 				{
 					t.vertex[0] = q1.vertex[0];
 					t.vertex[1] = q1.vertex[1];
 					t.vertex[2] = q1.vertex[2];
-					tri_vec.push_back(t);
+					add_triangle(t);
 
 					t.vertex[0] = q1.vertex[0];
 					t.vertex[1] = q1.vertex[2];
 					t.vertex[2] = q1.vertex[3];
-					tri_vec.push_back(t);
+					add_triangle(t);
 				}
 
 
-				// Note that this index is possibly out of range, 
-				// which is why it's used second in the if()
-				neighbour_index = x + y * v.voxel_x_res + (z + 1) * v.voxel_x_res * v.voxel_y_res;
-				if (z == v.voxel_z_res - 1 || 0 == v.voxel_densities[neighbour_index])
+				// Note that this neighbour is possibly out of range, 
+				// which is why it's tested second in the if()
+				if (z == v.voxel_z_res - 1 || !v.voxel_densities.test(x, y, z + 1))
 				{
 					t.vertex[0] = q2.vertex[0];
 					t.vertex[1] = q2.vertex[1];
 					t.vertex[2] = q2.vertex[2];
-					tri_vec.push_back(t);
+					add_triangle(t);
 
 					t.vertex[0] = q2.vertex[0];
 					t.vertex[1] = q2.vertex[2];
 					t.vertex[2] = q2.vertex[3];
-					tri_vec.push_back(t);
+					add_triangle(t);
 				}
 
 
-				// Note that this index is possibly out of range, 
-				// which is why it's used second in the if()
-				neighbour_index = x + (y)*v.voxel_x_res + (z - 1) * v.voxel_x_res * v.voxel_y_res;
-				if (z == 0 || 0 == v.voxel_densities[neighbour_index])
+				// Note that this neighbour is possibly out of range, 
+				// which is why it's tested second in the if()
+				if (z == 0 || !v.voxel_densities.test(x, y, z - 1))
 				{
 					t.vertex[0] = q3.vertex[0];
 					t.vertex[1] = q3.vertex[1];
 					t.vertex[2] = q3.vertex[2];
-					tri_vec.push_back(t);
+					add_triangle(t);
 
 					t.vertex[0] = q3.vertex[0];
 					t.vertex[1] = q3.vertex[2];
 					t.vertex[2] = q3.vertex[3];
-					tri_vec.push_back(t);
+					add_triangle(t);
 				}
 
 
-				// Note that this index is possibly out of range, 
-				// which is why it's used second in the if()
-				neighbour_index = (x + 1) + (y)*v.voxel_x_res + (z)*v.voxel_x_res * v.voxel_y_res;
-				if (x == v.voxel_x_res - 1 || 0 == v.voxel_densities[neighbour_index])
+				// Note that this neighbour is possibly out of range, 
+				// which is why it's tested second in the if()
+				if (x == v.voxel_x_res - 1 || !v.voxel_densities.test(x + 1, y, z))
 				{
 					t.vertex[0] = q4.vertex[0];
 					t.vertex[1] = q4.vertex[1];
 					t.vertex[2] = q4.vertex[2];
-					tri_vec.push_back(t);
+					add_triangle(t);
 
 					t.vertex[0] = q4.vertex[0];
 					t.vertex[1] = q4.vertex[2];
 					t.vertex[2] = q4.vertex[3];
-					tri_vec.push_back(t);
+					add_triangle(t);
 				}
 
-				// Note that this index is possibly out of range, 
-				// which is why it's used second in the if()
-				neighbour_index = (x - 1) + (y)*v.voxel_x_res + (z)*v.voxel_x_res * v.voxel_y_res;
-				if (x == 0 || 0 == v.voxel_densities[neighbour_index])
+				// Note that this neighbour is possibly out of range, 
+				// which is why it's tested second in the if()
+				if (x == 0 || !v.voxel_densities.test(x - 1, y, z))
 				{
 					t.vertex[0] = q5.vertex[0];
 					t.vertex[1] = q5.vertex[1];
 					t.vertex[2] = q5.vertex[2];
-					tri_vec.push_back(t);
+					add_triangle(t);
 
 					t.vertex[0] = q5.vertex[0];
 					t.vertex[1] = q5.vertex[2];
 					t.vertex[2] = q5.vertex[3];
-					tri_vec.push_back(t);
+					add_triangle(t);
 				}
 			}
 		}
@@ -717,28 +2703,192 @@ bool get_triangles(vector<custom_math::triangle>& tri_vec, voxel_object& v)
 
 
 
+	tri_vec.shrink_to_fit();
+
 	cout << tri_vec.size() << endl;
 
+	return true;
+}
 
 
 
 
+// Greedy meshing: like get_triangles, but the exposed faces of each slice
+// are merged into maximal rectangles of the same colour, so a flat region
+// becomes one quad instead of one quad per voxel.
+// T is either vector<custom_math::triangle> or indexed_mesh
+template<class T>
+bool get_triangles_greedy(T& tri_vec, voxel_object& v)
+{
+	tri_vec.clear();
 
+	if (v.get_cell_count() == 0)
+		return false;
 
-	for (size_t i = 0; i < tri_vec.size(); i++)
-	{
-		static const float pi = 4.0f * atanf(1.0f);
-		tri_vec[i].vertex[0].rotate_x(pi - pi / 2.0f);
-		tri_vec[i].vertex[1].rotate_x(pi - pi / 2.0f);
-		tri_vec[i].vertex[2].rotate_x(pi - pi / 2.0f);
-	}
+	static const float pi = 4.0f * atanf(1.0f);
+
+	// Voxel (x, y, z) is centred at origin + (x, y, z) * cell_size,
+	// before the rotation that get_voxels applies
+	custom_math::position_3 origin = v.get_voxel_centre(0, 0, 0);
+	origin.rotate_x(-(pi - pi / 2.0f));
+
+	const size_t res[3] = { v.voxel_x_res, v.voxel_y_res, v.voxel_z_res };
+
+	// Normal axis and direction of each face, in the same order as the
+	// quads in get_triangles: top, bottom, front, back, right, left
+	static const int face_axis[6] = { 1, 1, 2, 2, 0, 0 };
+	static const int face_sign[6] = { 1, -1, 1, -1, 1, -1 };
+
+	// Which side of the rectangle each quad corner is on, along x, y and z.
+	// These match the corners of q0 to q5 in get_triangles, so the winding
+	// is the same as the per-face mesher.
+	static const int corner_signs[6][4][3] = {
+		{ { 1, 1, -1 }, { -1, 1, -1 }, { -1, 1, 1 }, { 1, 1, 1 } },
+		{ { 1, -1, 1 }, { -1, -1, 1 }, { -1, -1, -1 }, { 1, -1, -1 } },
+		{ { 1, 1, 1 }, { -1, 1, 1 }, { -1, -1, 1 }, { 1, -1, 1 } },
+		{ { 1, -1, -1 }, { -1, -1, -1 }, { -1, 1, -1 }, { 1, 1, -1 } },
+		{ { 1, 1, -1 }, { 1, 1, 1 }, { 1, -1, 1 }, { 1, -1, -1 } },
+		{ { -1, 1, 1 }, { -1, 1, -1 }, { -1, -1, -1 }, { -1, -1, 1 } }
+	};
+
+	vector<long long signed int> mask;
 
-	for (size_t i = 0; i < v.voxel_centres.size(); i++)
+	for (int face = 0; face < 6; face++)
 	{
-		static const float pi = 4.0f * atanf(1.0f);
-		v.voxel_centres[i].rotate_x(pi - pi / 2.0f);
+		const int a = face_axis[face];
+		const int s = face_sign[face];
+
+		// The two axes that span the slice
+		const int b = (a + 1) % 3;
+		const int c = (a + 2) % 3;
+
+		mask.resize(res[b] * res[c]);
+
+		for (size_t i = 0; i < res[a]; i++)
+		{
+			// Find the exposed faces in this slice
+			for (size_t k = 0; k < res[c]; k++)
+			{
+				for (size_t j = 0; j < res[b]; j++)
+				{
+					size_t p[3];
+					p[a] = i;
+					p[b] = j;
+					p[c] = k;
+
+					long long signed int m = -1;
+
+					if (v.voxel_densities.test(p[0], p[1], p[2]))
+					{
+						// The face is exposed on the last slice along its
+						// normal, or when the neighbour beyond it is empty
+						const bool at_edge = (s > 0) ? (i == res[a] - 1) : (i == 0);
+
+						size_t n[3] = { p[0], p[1], p[2] };
+						n[a] += s;
+
+						if (at_edge || !v.voxel_densities.test(n[0], n[1], n[2]))
+							m = p[0] + p[1] * v.voxel_x_res + p[2] * v.voxel_x_res * v.voxel_y_res;
+					}
+
+					mask[j + k * res[b]] = m;
+				}
+			}
+
+			// Merge the exposed faces into rectangles
+			for (size_t k = 0; k < res[c]; k++)
+			{
+				for (size_t j = 0; j < res[b]; )
+				{
+					const long long signed int m = mask[j + k * res[b]];
+
+					if (m == -1)
+					{
+						j++;
+						continue;
+					}
+
+					const glm::vec4 colour = v.voxel_colours.get(m);
+
+					const auto same_colour = [&](const long long signed int other)
+					{
+						if (other == -1)
+							return false;
+
+						const glm::vec4 other_colour = v.voxel_colours.get(other);
+
+						return other_colour.r == colour.r && other_colour.g == colour.g && other_colour.b == colour.b;
+					};
+
+					size_t width = 1;
+
+					while (j + width < res[b] && same_colour(mask[j + width + k * res[b]]))
+						width++;
+
+					size_t height = 1;
+
+					while (k + height < res[c])
+					{
+						bool row_matches = true;
+
+						for (size_t w = 0; w < width && row_matches; w++)
+							row_matches = same_colour(mask[j + w + (k + height) * res[b]]);
+
+						if (!row_matches)
+							break;
+
+						height++;
+					}
+
+					for (size_t h = 0; h < height; h++)
+						for (size_t w = 0; w < width; w++)
+							mask[j + w + (k + h) * res[b]] = -1;
+
+					// Rectangle bounds, in voxel units
+					float lo[3], hi[3];
+					lo[a] = hi[a] = static_cast<float>(i);
+					lo[b] = static_cast<float>(j);
+					hi[b] = static_cast<float>(j + width - 1);
+					lo[c] = static_cast<float>(k);
+					hi[c] = static_cast<float>(k + height - 1);
+
+					custom_math::position_3 q[4];
+
+					for (size_t corner = 0; corner < 4; corner++)
+					{
+						const int* sign = corner_signs[face][corner];
+
+						q[corner] = custom_math::position_3(
+							origin.x + v.cell_size * (sign[0] > 0 ? hi[0] + 0.5f : lo[0] - 0.5f),
+							origin.y + v.cell_size * (sign[1] > 0 ? hi[1] + 0.5f : lo[1] - 0.5f),
+							origin.z + v.cell_size * (sign[2] > 0 ? hi[2] + 0.5f : lo[2] - 0.5f));
+
+						q[corner].rotate_x(pi - pi / 2.0f);
+					}
+
+					custom_math::triangle t;
+
+					t.colour.x = colour.r;
+					t.colour.y = colour.g;
+					t.colour.z = colour.b;
+
+					t.vertex[0] = q[0];
+					t.vertex[1] = q[1];
+					t.vertex[2] = q[2];
+					tri_vec.push_back(t);
+
+					t.vertex[0] = q[0];
+					t.vertex[1] = q[2];
+					t.vertex[2] = q[3];
+					tri_vec.push_back(t);
+
+					j += width;
+				}
+			}
+		}
 	}
 
+	tri_vec.shrink_to_fit();
 
 	return true;
 }
@@ -757,55 +2907,104 @@ bool get_triangles(vector<custom_math::triangle>& tri_vec, voxel_object& v)
 //}
 
 
-void get_background_points(voxel_object& v)
+// Call func(z_begin, z_end) for every z-slab of a lattice that is z_count
+// points deep, on num_threads threads. The slabs are handed out from a
+// shared counter, so that threads which get the cheap (empty) slabs go on
+// to take more of them.
+template<class T>
+void for_each_z_slab(const size_t z_count, const size_t num_threads, T func)
 {
-	float x_grid_min = -x_grid_max;
-	float y_grid_min = -y_grid_max;
-	float z_grid_min = -z_grid_max;
+	const size_t slab_depth = 4;
 
-	v.background_indices.resize(x_res * y_res * z_res);
-	v.background_centres.resize(x_res * y_res * z_res);
-	v.background_densities.resize(x_res * y_res * z_res);
-	v.background_collisions.resize(x_res * y_res * z_res);
+	if (num_threads <= 1)
+	{
+		func(0, z_count);
+		return;
+	}
 
-	const float x_step_size = (x_grid_max - x_grid_min) / (x_res - 1);
-	const float y_step_size = (y_grid_max - y_grid_min) / (y_res - 1);
-	const float z_step_size = (z_grid_max - z_grid_min) / (z_res - 1);
+	std::atomic<size_t> next_slab(0);
 
-	custom_math::vertex_3 Z(x_grid_min, y_grid_min, x_grid_min);
+	vector<std::thread> threads;
 
-	for (size_t z = 0; z < z_res; z++, Z.z += z_step_size)
+	for (size_t t = 0; t < num_threads; t++)
 	{
-		Z.x = x_grid_min;
+		threads.push_back(std::thread([&]()
+			{
+				while (true)
+				{
+					const size_t z_begin = slab_depth * next_slab++;
 
-		for (size_t x = 0; x < x_res; x++, Z.x += x_step_size)
-		{
-			Z.y = y_grid_min;
+					if (z_begin >= z_count)
+						break;
 
-			for (size_t y = 0; y < y_res; y++, Z.y += y_step_size)
-			{
-				const custom_math::vertex_3 test_point(Z.x, Z.y, Z.z);
+					func(z_begin, std::min(z_begin + slab_depth, z_count));
+				}
+			}));
+	}
 
-				const size_t index = x + (y * x_res) + (z * x_res * y_res);
+	for (size_t t = 0; t < threads.size(); t++)
+		threads[t].join();
+}
 
-				size_t voxel_index = 0;
 
-				v.background_centres[index] = test_point;
-				v.background_indices[index] = glm::ivec3(x, y, z);
+void get_background_surface(voxel_object& v);
 
-				if (v.is_point_in_voxel_grid(test_point, v.model_matrix, voxel_index, v))
-				{
-					v.background_densities[index] = 1.0;
-					v.background_collisions[index] = voxel_index;
-				}
-				else
+void get_background_points(voxel_object& v)
+{
+	v.background_lattice = lattice_descriptor(x_res, y_res, z_res, x_grid_max, y_grid_max, z_grid_max);
+
+	const lattice_descriptor& lattice = v.background_lattice;
+
+	v.background_densities.resize(lattice.x_res, lattice.y_res, lattice.z_res);
+	v.background_collisions.resize(lattice.size());
+
+	if (rasterize_background)
+	{
+		vector<lattice_box> boxes;
+		v.get_voxel_lattice_boxes(v.background_lattice, v.model_matrix, boxes);
+
+		for_each_z_slab(lattice.z_res, background_thread_count, [&](const size_t z_begin, const size_t z_end)
+			{
+				v.rasterize_voxel_boxes(
+					v.background_lattice,
+					boxes,
+					z_begin, z_end,
+					v.model_matrix,
+					v.background_densities,
+					v.background_collisions);
+			});
+	}
+	else
+	{
+		// Only the lattice points inside the transformed voxel grid's
+		// bounding box can be inside a voxel; the rest stay cleared
+		lattice_box bounds;
+
+		if (v.get_grid_lattice_box(v.background_lattice, v.model_matrix, bounds))
+		{
+			for_each_z_slab(lattice.z_res, background_thread_count, [&](const size_t z_begin, const size_t z_end)
 				{
-					v.background_densities[index] = 0.0;
-				}
-			}
+					v.classify_lattice_points(
+						v.background_lattice,
+						bounds,
+						z_begin, z_end,
+						v.model_matrix,
+						v.background_densities,
+						v.background_collisions);
+				});
 		}
 	}
 
+	v.background_model_matrix = v.model_matrix;
+	v.background_sampled = true;
+
+	get_background_surface(v);
+}
+
+// Find the surface points of the classified background lattice, and the
+// collisions of their neighbours
+void get_background_surface(voxel_object& v)
+{
 	// Define the coordinates for 6 adjacent neighbors (up, down, left, right, front, back)
 	static const int directions[6][3] = {
 		{1, 0, 0}, {-1, 0, 0},  // x directions
@@ -813,83 +3012,135 @@ void get_background_points(voxel_object& v)
 		{0, 0, 1}, {0, 0, -1}   // z directions
 	};
 
-	// Initialize with the same grid size as background points
-	//const size_t x_res = background_indices.empty() ? 0 : background_indices[background_indices.size() - 1].x + 1;
-	//const size_t y_res = background_indices.empty() ? 0 : background_indices[background_indices.size() - 1].y + 1;
-	//const size_t z_res = background_indices.empty() ? 0 : background_indices[background_indices.size() - 1].z + 1;
+	const lattice_descriptor& lattice = v.background_lattice;
 
 	// Clear any existing data
-	v.background_surface_indices.clear();
-	v.background_surface_indices.resize(x_res * y_res * z_res);
-	v.background_surface_centres.clear();
-	v.background_surface_centres.resize(x_res * y_res * z_res);
-	v.background_surface_densities.clear();
-	v.background_surface_densities.resize(x_res * y_res * z_res);
-	v.background_surface_collisions.clear();
-	v.background_surface_collisions.resize(x_res * y_res * z_res);
-
-	// Check each point in the background grid
-	for (size_t i = 0; i < v.background_centres.size(); i++)
-	{
-		// Skip points that are already inside the voxel grid
-		if (v.background_densities[i] > 0)
-			continue;
+	v.background_surface_densities.resize(lattice.x_res, lattice.y_res, lattice.z_res);
+	v.background_surface_collisions.resize(lattice.size());
+
+	// Find the surface points: the empty points with at least one of their
+	// 6 neighbours inside the voxel grid, a whole word of points at a time.
+	// The first pass is complete by now, so a slab can safely read the
+	// densities of its neighbouring slabs; it only writes to its own points.
+	// Then count the collisions of each surface point.
+	for_each_z_slab(lattice.z_res, background_thread_count, [&](const size_t z_begin, const size_t z_end)
+		{
+			v.background_densities.get_surface(v.background_surface_densities, z_begin, z_end);
 
-		// Get the grid coordinates for this point
-		const int x = v.background_indices[i].x;
-		const int y = v.background_indices[i].y;
-		const int z = v.background_indices[i].z;
+			std::fill(
+				v.background_surface_collisions.offsets.begin() + 1 + lattice.index(0, 0, z_begin),
+				v.background_surface_collisions.offsets.begin() + 1 + lattice.index(0, 0, z_end),
+				0);
 
-		const size_t index = x + (y * x_res) + (z * x_res * y_res);
+			v.background_surface_densities.for_each_set(z_begin, z_end, [&](const size_t x, const size_t y, const size_t z)
+				{
+					const size_t index = lattice.index(x, y, z);
 
-		// Check all 6 adjacent neighbors
+					uint32_t collision_count = 0;
 
-		bool is_surface = false;
+					// Check all 6 adjacent neighbors
+					for (int dir = 0; dir < 6; dir++)
+					{
+						const int nx = static_cast<int>(x) + directions[dir][0];
+						const int ny = static_cast<int>(y) + directions[dir][1];
+						const int nz = static_cast<int>(z) + directions[dir][2];
 
-		for (int dir = 0; dir < 6; dir++)
-		{
-			const int nx = x + directions[dir][0];
-			const int ny = y + directions[dir][1];
-			const int nz = z + directions[dir][2];
+						// Skip if neighbor is outside the grid
+						if (nx < 0 || nx >= static_cast<int>(lattice.x_res) ||
+							ny < 0 || ny >= static_cast<int>(lattice.y_res) ||
+							nz < 0 || nz >= static_cast<int>(lattice.z_res))
+						{
+							continue;
+						}
 
-			// Skip if neighbor is outside the grid
-			if (nx < 0 || nx >= static_cast<int>(x_res) ||
-				ny < 0 || ny >= static_cast<int>(y_res) ||
-				nz < 0 || nz >= static_cast<int>(z_res))
-			{
-				continue;
-			}
+						if (v.background_densities.test(nx, ny, nz))
+							collision_count++;
+					}
 
-			// Calculate the index of the neighboring point
-			size_t neighbor_index = nx + (ny * x_res) + (nz * x_res * y_res);
+					v.background_surface_collisions.offsets[index + 1] = collision_count;
+				});
+		});
 
-			// If the neighboring point is inside the voxel grid, this is a surface point
-			if (neighbor_index < v.background_densities.size() && v.background_densities[neighbor_index] > 0)
-			{
-				is_surface = true;
+	v.background_surface_collisions.build_offsets();
+
+	// Now that every row has its place, store the collisions
+	for_each_z_slab(lattice.z_res, background_thread_count, [&](const size_t z_begin, const size_t z_end)
+		{
+			v.background_surface_densities.for_each_set(z_begin, z_end, [&](const size_t x, const size_t y, const size_t z)
+				{
+					const size_t index = lattice.index(x, y, z);
+
+					uint32_t* collision = &v.background_surface_collisions.ids[v.background_surface_collisions.offsets[index]];
+
+					for (int dir = 0; dir < 6; dir++)
+					{
+						const int nx = static_cast<int>(x) + directions[dir][0];
+						const int ny = static_cast<int>(y) + directions[dir][1];
+						const int nz = static_cast<int>(z) + directions[dir][2];
+
+						if (nx < 0 || nx >= static_cast<int>(lattice.x_res) ||
+							ny < 0 || ny >= static_cast<int>(lattice.y_res) ||
+							nz < 0 || nz >= static_cast<int>(lattice.z_res))
+						{
+							continue;
+						}
+
+						if (v.background_densities.test(nx, ny, nz))
+						{
+							const size_t neighbor_index = lattice.index(nx, ny, nz);
+							*collision++ = static_cast<uint32_t>(v.background_collisions[neighbor_index]);
+						}
+					}
+				});
+		});
+	v.background_dirty = true;
+}
 
-				const size_t collision = v.background_collisions[neighbor_index];
+// Incremental version of get_background_points, for when the model matrix
+// has changed by a small rotation since the last call. Only the lattice
+// points that the model's surface has swept through are reclassified; the
+// rest keep their densities. (The collisions of points well inside the
+// model may then be out of date, but only the collisions next to the
+// surface are used.)
+// Falls back to get_background_points when that would be no slower.
+void update_background_points(voxel_object& v)
+{
+	vector<lattice_box> boxes;
 
-				v.background_surface_collisions[index].push_back(collision);
-			}
-		}
+	if (!v.background_sampled ||
+		!v.get_swept_surface_boxes(v.background_lattice, v.background_model_matrix, v.model_matrix, boxes))
+	{
+		get_background_points(v);
+		return;
+	}
 
+	const lattice_descriptor& lattice = v.background_lattice;
 
-		v.background_surface_indices[index] = v.background_indices[i];
-		v.background_surface_centres[index] = v.background_centres[i];
+	v.background_update_mask.resize(lattice.x_res, lattice.y_res, lattice.z_res);
 
-		if (is_surface)
+	for_each_z_slab(lattice.z_res, background_thread_count, [&](const size_t z_begin, const size_t z_end)
 		{
-			//cout << background_surface_collisions[index].size() << endl;
-			v.background_surface_densities[index] = 1.0;
-		}
-		else
-		{
-			v.background_surface_densities[index] = 0.0;
-		}
-	}
+			for (size_t i = 0; i < boxes.size(); i++)
+			{
+				const lattice_box& b = boxes[i];
+
+				for (size_t z = std::max(z_begin, size_t(b.min[2])); z < std::min(z_end, size_t(b.max[2] + 1)); z++)
+					for (size_t y = b.min[1]; y <= size_t(b.max[1]); y++)
+						v.background_update_mask.set_range(b.min[0], b.max[0] + 1, y, z);
+			}
+
+			v.reclassify_lattice_points(
+				v.background_lattice,
+				v.background_update_mask,
+				z_begin, z_end,
+				v.model_matrix,
+				v.background_densities,
+				v.background_collisions);
+		});
 
+	v.background_model_matrix = v.model_matrix;
 
+	get_background_surface(v);
 }
 
 
@@ -904,38 +3155,44 @@ void get_surface_points(void)
 
 
 
-void do_blackening(voxel_object &v)
+// Fill test_texture with black below half height and white above it, for do_blackening
+void get_test_texture(void)
 {
+	test_texture.resize(x_res * y_res * z_res, 0); // initialize to black
+
 	for (size_t x = 0; x < x_res; x++)
 	{
 		for (size_t y = 0; y < y_res; y++)
 		{
 			for (size_t z = 0; z < z_res; z++)
 			{
-				const size_t index = x + y * x_res + z * x_res * y_res;
-
-				if (v.background_surface_densities[index] == 0.0)
-					continue;
-
-				for (size_t i = 0; i < v.background_surface_collisions[index].size(); i++)
-				{
-					v.voxel_colours[v.background_surface_collisions[index][i]].r *= test_texture[index] / 255.0f;
-					v.voxel_colours[v.background_surface_collisions[index][i]].g *= test_texture[index] / 255.0f;
-					v.voxel_colours[v.background_surface_collisions[index][i]].b *= test_texture[index] / 255.0f;
-					v.voxel_colours[v.background_surface_collisions[index][i]].a = 1.0f;
-				}
-
-				//cout << background_surface_collisions[index].size() << endl;
+				const size_t voxel_index = x + y * x_res + z * x_res * y_res;
 
-				//if (y >= voxel_y_res / 2)
-				//	test_texture[voxel_index] = 1.0;
-				//else
-				//	test_texture[voxel_index] = 0.0;
+				if (y >= y_res / 2)
+					test_texture[voxel_index] = 255;
 			}
 		}
 	}
+}
+
+void do_blackening(voxel_object &v)
+{
+	const lattice_descriptor& lattice = v.background_lattice;
 
+	v.background_surface_densities.for_each_set([&](const size_t x, const size_t y, const size_t z)
+		{
+			const size_t index = lattice.index(x, y, z);
+
+			for (const uint32_t* i = v.background_surface_collisions.begin(index); i != v.background_surface_collisions.end(index); i++)
+			{
+				glm::vec4& colour = v.voxel_colours.at(*i);
 
+				colour.r *= test_texture[index] / 255.0f;
+				colour.g *= test_texture[index] / 255.0f;
+				colour.b *= test_texture[index] / 255.0f;
+				colour.a = 1.0f;
+			}
+		});
 }
 
 
@@ -30,6 +30,12 @@ static void  _ogt_priv_free_default(void* ptr) { free(ptr); }
 static ogt_vox_alloc_func g_alloc_func = _ogt_priv_alloc_default; // default function for allocating
 static ogt_vox_free_func  g_free_func = _ogt_priv_free_default;   // default  function for freeing.
 
+// number of threads used to unpack models in ogt_vox_read_scene. 0 means one per hardware thread.
+static uint32_t g_read_thread_count = 0;
+
+// number of threads used to pack model voxels in ogt_vox_write_scene. 0 means one per hardware thread.
+static uint32_t g_write_thread_count = 0;
+
 // set the provided allocate/free functions if they are non-null, otherwise reset to default allocate/free functions
 void ogt_vox_set_memory_allocator(ogt_vox_alloc_func alloc_func, ogt_vox_free_func free_func)
 {
@@ -46,8 +52,182 @@ void ogt_vox_set_memory_allocator(ogt_vox_alloc_func alloc_func, ogt_vox_free_fu
     }
 }
 
+// arena allocation. With arena allocation enabled, ogt_vox_read_scene_with_flags uses two arenas: the scene's
+// own, which holds the models and the output arrays and is released all at once by ogt_vox_destroy_scene, and
+// the thread's scratch arena for the parsing state, which is emptied for the next parse. While parsing,
+// g_thread_arena points at the scratch arena, and every _vox_malloc on that thread is bumped from its newest
+// block. Frees are ignored, other than giving back the most recent allocation.
+struct _vox_arena_block {
+    _vox_arena_block* next;   // the previous (older) block
+    size_t            size;   // bytes available after the header
+    size_t            used;
+};
+
+struct _vox_arena {
+    _vox_arena_block* blocks;      // newest first. allocations always come from the newest.
+    void*             last_alloc;  // the most recent allocation, which can still be grown in place or given back.
+};
+
+static const size_t k_vox_arena_alignment = 16;
+static const size_t k_vox_arena_header_size = (sizeof(_vox_arena_block) + k_vox_arena_alignment - 1) & ~(k_vox_arena_alignment - 1);
+
+static bool g_arena_allocation = false;
+static thread_local _vox_arena* g_thread_arena = NULL;
+
+static size_t _vox_arena_align(size_t size) {
+    return (size + k_vox_arena_alignment - 1) & ~(k_vox_arena_alignment - 1);
+}
+
+static uint8_t* _vox_arena_block_data(_vox_arena_block* block) {
+    return (uint8_t*)block + k_vox_arena_header_size;
+}
+
+// creates an arena whose first block holds the arena itself plus initial_size bytes.
+static _vox_arena* _vox_arena_create(size_t initial_size) {
+    size_t arena_size = _vox_arena_align(sizeof(_vox_arena));
+    size_t size = arena_size + _vox_arena_align(initial_size);
+    _vox_arena_block* block = (_vox_arena_block*)g_alloc_func(k_vox_arena_header_size + size);
+    if (!block)
+        return NULL;
+    block->next = NULL;
+    block->size = size;
+    block->used = arena_size;
+    _vox_arena* arena = (_vox_arena*)_vox_arena_block_data(block);
+    arena->blocks = block;
+    arena->last_alloc = NULL;
+    return arena;
+}
+
+// frees all blocks, including the one that holds the arena itself.
+static void _vox_arena_destroy(_vox_arena* arena) {
+    _vox_arena_block* block = arena->blocks;
+    while (block) {
+        _vox_arena_block* next = block->next;
+        g_free_func(block);
+        block = next;
+    }
+}
+
+static bool _vox_arena_add_block(_vox_arena* arena, size_t size) {
+    _vox_arena_block* block = (_vox_arena_block*)g_alloc_func(k_vox_arena_header_size + size);
+    if (!block)
+        return false;
+    block->next = arena->blocks;
+    block->size = size;
+    block->used = 0;
+    arena->blocks = block;
+    return true;
+}
+
+// makes sure that the next size bytes of (aligned) allocations fit in the newest block.
+static bool _vox_arena_reserve(_vox_arena* arena, size_t size) {
+    size = _vox_arena_align(size);
+    _vox_arena_block* block = arena->blocks;
+    return block->size - block->used >= size || _vox_arena_add_block(arena, size);
+}
+
+static void* _vox_arena_alloc(_vox_arena* arena, size_t size) {
+    size = _vox_arena_align(size);
+    _vox_arena_block* block = arena->blocks;
+    if (block->size - block->used < size) {
+        // the estimate fell short, so add another block as big as the last.
+        if (!_vox_arena_add_block(arena, block->size > size ? block->size : size))
+            return NULL;
+        block = arena->blocks;
+    }
+    void* ptr = _vox_arena_block_data(block) + block->used;
+    block->used += size;
+    arena->last_alloc = ptr;
+    return ptr;
+}
+
+// grows ptr to new_size without moving it if it is the most recent allocation and there's room.
+static bool _vox_arena_grow(_vox_arena* arena, void* ptr, size_t new_size) {
+    if (!ptr || ptr != arena->last_alloc)
+        return false;
+    _vox_arena_block* block = arena->blocks;
+    size_t offset = (uint8_t*)ptr - _vox_arena_block_data(block);
+    new_size = _vox_arena_align(new_size);
+    if (offset + new_size > block->size)
+        return false;
+    block->used = offset + new_size;
+    return true;
+}
+
+// only the most recent allocation can be given back. anything else is released with the arena.
+static void _vox_arena_free(_vox_arena* arena, void* ptr) {
+    if (ptr == arena->last_alloc) {
+        arena->blocks->used = (uint8_t*)ptr - _vox_arena_block_data(arena->blocks);
+        arena->last_alloc = NULL;
+    }
+}
+
+// owns an arena until the end of the scope. Unless release() hands the arena over to a scene, it is
+// destroyed at the end of the scope, so parses that bail out early don't leak it.
+struct _vox_arena_scope {
+    _vox_arena* arena;
+    _vox_arena_scope(_vox_arena* in_arena) : arena(in_arena) { }
+    ~_vox_arena_scope() {
+        if (arena)
+            _vox_arena_destroy(arena);
+    }
+    _vox_arena* release() {
+        _vox_arena* released = arena;
+        arena = NULL;
+        return released;
+    }
+};
+
+// makes this thread allocate from an arena until the end of the scope.
+struct _vox_thread_arena_scope {
+    _vox_thread_arena_scope(_vox_arena* arena) {
+        g_thread_arena = arena;
+    }
+    ~_vox_thread_arena_scope() {
+        g_thread_arena = NULL;
+    }
+};
+
+// each thread keeps its scratch arena between parses, so a thread that reads scene after scene reuses the
+// same, already faulted-in memory. It is freed when the thread exits or disables arena allocation.
+struct _vox_scratch_arena_cache {
+    _vox_arena* arena;
+    ~_vox_scratch_arena_cache() {
+        if (arena)
+            _vox_arena_destroy(arena);
+    }
+};
+static thread_local _vox_scratch_arena_cache g_scratch_arena_cache = { NULL };
+
+// returns this thread's scratch arena, emptied, with room for at least size bytes in one block.
+static _vox_arena* _vox_get_scratch_arena(size_t size) {
+    _vox_arena* arena = g_scratch_arena_cache.arena;
+    if (arena) {
+        // an arena that needed more blocks last time is replaced by one that fits everything it held.
+        size_t total_used = 0;
+        for (_vox_arena_block* block = arena->blocks; block; block = block->next)
+            total_used += block->used;
+        _vox_arena_block* first_block = arena->blocks;
+        while (first_block->next)
+            first_block = first_block->next;
+        size_t arena_size = _vox_arena_align(sizeof(_vox_arena));
+        if (arena->blocks == first_block && first_block->size >= arena_size + _vox_arena_align(size)) {
+            first_block->used = arena_size;
+            arena->last_alloc = NULL;
+            return arena;
+        }
+        if (total_used > size)
+            size = total_used;
+        _vox_arena_destroy(arena);
+    }
+    g_scratch_arena_cache.arena = _vox_arena_create(size);
+    return g_scratch_arena_cache.arena;
+}
+
 static void* _vox_malloc(size_t size) {
-    return size ? g_alloc_func(size) : NULL;
+    if (!size)
+        return NULL;
+    return g_thread_arena ? _vox_arena_alloc(g_thread_arena, size) : g_alloc_func(size);
 }
 
 static void* _vox_calloc(size_t size) {
@@ -58,10 +238,35 @@ static void* _vox_calloc(size_t size) {
 }
 
 static void _vox_free(void* old_ptr) {
-    if (old_ptr)
+    if (!old_ptr)
+        return;
+    if (g_thread_arena)
+        _vox_arena_free(g_thread_arena, old_ptr);
+    else
         g_free_func(old_ptr);
 }
 
+// memory that ends up in a scene comes from the scene's arena if it has one, and from _vox_malloc otherwise.
+static void* _vox_scene_malloc(_vox_arena* scene_arena, size_t size) {
+    if (!scene_arena)
+        return _vox_malloc(size);
+    return size ? _vox_arena_alloc(scene_arena, size) : NULL;
+}
+
+static void* _vox_scene_calloc(_vox_arena* scene_arena, size_t size) {
+    void* pMem = _vox_scene_malloc(scene_arena, size);
+    if (pMem)
+        memset(pMem, 0, size);
+    return pMem;
+}
+
+static void _vox_scene_free(_vox_arena* scene_arena, void* ptr) {
+    if (!scene_arena)
+        _vox_free(ptr);
+    else if (ptr)
+        _vox_arena_free(scene_arena, ptr);
+}
+
 
 // finds an exact color in the specified palette if it exists, and UINT32_MAX otherwise
 static uint32_t find_exact_color_in_palette(const ogt_vox_rgba* palette, uint32_t palette_count, const ogt_vox_rgba color_to_find) {
@@ -118,6 +323,11 @@ const ogt_vox_scene* ogt_vox_read_scene(const uint8_t* buffer, uint32_t buffer_s
 
 void ogt_vox_destroy_scene(const ogt_vox_scene* _scene) {
     ogt_vox_scene* scene = const_cast<ogt_vox_scene*>(_scene);
+    // a scene that was read into an arena, scene included, is released all at once.
+    if (scene->arena) {
+        _vox_arena_destroy((_vox_arena*)scene->arena);
+        return;
+    }
     // free models from model array
     for (uint32_t i = 0; i < scene->num_models; i++)
         _vox_free((void*)scene->models[i]);
@@ -166,28 +376,56 @@ static uint8_t _vox_make_packed_rotation_from_transform(const ogt_vox_transform*
     return (row0_index) | (row1_index << 2) | (row0_negative ? 1 << 4 : 0) | (row1_negative ? 1 << 5 : 0) | (row2_negative ? 1 << 6 : 0);
 }
 
+// once this much is buffered, a streaming writer hands it to its write_func at the next chunk boundary.
+static const uint32_t k_vox_write_flush_size = 64 * 1024;
+
 struct _vox_file_writeable {
-    _vox_array<uint8_t> data;
+    _vox_array<uint8_t> data;           // everything written after the first flushed_size bytes of the file.
+    uint32_t            flushed_size;   // number of bytes already handed to write_func (or counted, when measuring).
+    ogt_vox_write_func  write_func;     // if NULL, the whole file stays in data.
+    void*               write_user_data;
+    bool                measure_only;   // only count the bytes that would be written, without storing any of them.
+    bool                failed;         // write_func returned false, nothing more is handed to it.
 };
 
-static void _vox_file_writeable_init(_vox_file_writeable* fp) {
-    fp->data.reserve(1024);
+static void _vox_file_writeable_init(_vox_file_writeable* fp, ogt_vox_write_func write_func = NULL, void* write_user_data = NULL, bool measure_only = false) {
+    fp->flushed_size = 0;
+    fp->write_func = write_func;
+    fp->write_user_data = write_user_data;
+    fp->measure_only = measure_only;
+    fp->failed = false;
+    if (!measure_only)
+        fp->data.reserve(write_func ? k_vox_write_flush_size + 1024 : 1024);
 }
 static void _vox_file_write(_vox_file_writeable* fp, const void* data, uint32_t data_size) {
-    fp->data.push_back_many((const uint8_t*)data, data_size);
+    if (fp->measure_only)
+        fp->flushed_size += data_size;
+    else
+        fp->data.push_back_many((const uint8_t*)data, data_size);
 }
 static void _vox_file_write_uint32(_vox_file_writeable* fp, uint32_t data) {
-    fp->data.push_back_many((const uint8_t*)&data, sizeof(uint32_t));
-}
-static void _vox_file_write_uint8(_vox_file_writeable* fp, uint8_t data) {
-    fp->data.push_back_many((const uint8_t*)&data, sizeof(uint8_t));
+    _vox_file_write(fp, &data, sizeof(uint32_t));
 }
 static void _vox_file_write_at_offset(_vox_file_writeable* fp, uint32_t offset, const void* data, uint32_t data_size) {
+    if (fp->measure_only)
+        return;
+    ogt_assert(offset >= fp->flushed_size, "write at offset must not patch data that was already flushed");
+    offset -= fp->flushed_size;
     ogt_assert((offset + data_size) <= fp->data.count, "write at offset must not be an append write");
     memcpy(&fp->data[offset], data, data_size);
 }
 static uint32_t _vox_file_get_offset(const _vox_file_writeable* fp) {
-    return (uint32_t)fp->data.count;
+    return fp->flushed_size + (uint32_t)fp->data.count;
+}
+// hands the buffered data to write_func once there is enough of it (or always, if force is set). Only call
+// this between chunks or inside a chunk whose size is already written, since flushed data can't be patched.
+static void _vox_file_flush(_vox_file_writeable* fp, bool force) {
+    if (!fp->write_func || fp->data.count == 0 || (!force && fp->data.count < k_vox_write_flush_size))
+        return;
+    if (!fp->failed && !fp->write_func(fp->data.data, (uint32_t)fp->data.count, fp->write_user_data))
+        fp->failed = true;
+    fp->flushed_size += (uint32_t)fp->data.count;
+    fp->data.count = 0;
 }
 static uint8_t* _vox_file_get_data(_vox_file_writeable* fp) {
     return &fp->data[0];
@@ -230,6 +468,7 @@ static void _vox_file_write_chunk_nTRN(_vox_file_writeable* fp, uint32_t node_id
     const char* hidden_string = hidden ? "1" : NULL;
     const char* loop_string = transform_anim->loop ? "1" : NULL;
 
+    _vox_file_flush(fp, false);
     uint32_t offset_of_chunk_header = _vox_file_get_offset(fp);
 
     // write the nTRN header
@@ -271,34 +510,184 @@ static void _vox_file_write_chunk_nTRN(_vox_file_writeable* fp, uint32_t node_id
     _vox_file_write_at_offset(fp, offset_of_chunk_header + 4, &chunk_size, sizeof(chunk_size));
 }
 
-// saves the scene out to a buffer that when saved as a .vox file can be loaded with magicavoxel.
-uint8_t* ogt_vox_write_scene(const ogt_vox_scene* scene, uint32_t* buffer_size) {
-    _vox_file_writeable file;
-    _vox_file_writeable_init(&file);
-    _vox_file_writeable* fp = &file;
+// calls job_func(i) for each i below num_jobs. If total_cost is high enough, the jobs are handed out in order
+// from a shared counter to up to thread_count threads (0 means one per hardware thread), so each job must
+// only write to what it owns. The calling thread is one of the workers.
+template <class F>
+static void _vox_parallel_for(uint32_t num_jobs, uint64_t total_cost, uint32_t thread_count, F job_func) {
+    // below this cost, starting threads costs more than it saves.
+    const uint64_t k_min_parallel_cost = 1 << 20;
+    const uint32_t k_max_threads = 64;
+
+    uint32_t num_threads = thread_count ? thread_count : std::thread::hardware_concurrency();
+    num_threads = num_threads < num_jobs ? num_threads : num_jobs;
+    num_threads = num_threads < k_max_threads ? num_threads : k_max_threads;
+
+    if (num_threads <= 1 || total_cost < k_min_parallel_cost) {
+        for (uint32_t i = 0; i < num_jobs; i++)
+            job_func(i);
+        return;
+    }
 
-    // write file header and file version
-    _vox_file_write_uint32(fp, CHUNK_ID_VOX_);
-    _vox_file_write_uint32(fp, 150);
+    std::atomic<uint32_t> next_job(0);
+    auto worker = [&]() {
+        for (uint32_t i = next_job++; i < num_jobs; i = next_job++)
+            job_func(i);
+    };
+
+    std::thread threads[k_max_threads];
+    for (uint32_t i = 1; i < num_threads; i++)
+        threads[i] = std::thread(worker);
+    worker();
+    for (uint32_t i = 1; i < num_threads; i++)
+        threads[i].join();
+}
 
-    // write the main chunk
-    _vox_file_write_uint32(fp, CHUNK_ID_MAIN);
-    _vox_file_write_uint32(fp, 0);
-    _vox_file_write_uint32(fp, 0);  // this main_chunk_child_size will get patched up once everything is written.
+// a range of z slices of one model, counted and then packed into XYZI voxels independently of the rest.
+struct _vox_xyzi_job {
+    const ogt_vox_model* model;
+    uint32_t             z_begin;
+    uint32_t             z_end;
+    uint32_t             num_voxels;    // solid voxels in these slices, filled in by the counting pass.
+    uint32_t             data_offset;   // where in the writeable's data the packed voxels go.
+    uint8_t*             packed_voxel_data;
+};
 
-    // we need to know how to patch up the main chunk size after we've written everything
-    const uint32_t offset_post_main_chunk = _vox_file_get_offset(fp);
+// jobs cover about this many voxels of the grid, so a big model is spread over threads too.
+static const uint32_t k_vox_xyzi_job_voxels = 1 << 18;
 
-    // write out all model chunks
+// returns a word with the high bit set in each byte of w that is non-zero.
+static inline uint64_t _vox_nonzero_byte_mask(uint64_t w) {
+    const uint64_t k_low_bits = 0x7f7f7f7f7f7f7f7full;
+    return (((w & k_low_bits) + k_low_bits) | w) & ~k_low_bits;
+}
+
+// counts the non-zero bytes in voxels, 8 at a time.
+static uint32_t _vox_count_solid_voxels(const uint8_t* voxels, uint32_t num_voxels) {
+    uint32_t count = 0;
+    uint32_t i = 0;
+    for (; i + 8 <= num_voxels; i += 8) {
+        uint64_t w;
+        memcpy(&w, &voxels[i], sizeof(w));
+        // sum the high bits into the top byte.
+        count += (uint32_t)(((_vox_nonzero_byte_mask(w) >> 7) * 0x0101010101010101ull) >> 56);
+    }
+    for (; i < num_voxels; i++)
+        count += voxels[i] != 0 ? 1 : 0;
+    return count;
+}
+
+static void _vox_count_xyzi_job(_vox_xyzi_job& job) {
+    const ogt_vox_model* model = job.model;
+    const uint32_t stride_z = model->size_x * model->size_y;
+    job.num_voxels = _vox_count_solid_voxels(&model->voxel_data[job.z_begin * stride_z], (job.z_end - job.z_begin) * stride_z);
+}
+
+// writes the x,y,z,color of each solid voxel in the job's slices, skipping empty runs of 8 voxels at once.
+static void _vox_pack_xyzi_job(_vox_xyzi_job& job) {
+    const ogt_vox_model* model = job.model;
+    const uint32_t size_x = model->size_x;
+    uint8_t* out = job.packed_voxel_data;
+    const uint8_t* row = &model->voxel_data[job.z_begin * size_x * model->size_y];
+    for (uint32_t z = job.z_begin; z < job.z_end; z++) {
+        for (uint32_t y = 0; y < model->size_y; y++, row += size_x) {
+            uint32_t x = 0;
+            for (; x + 8 <= size_x; x += 8) {
+                uint64_t w;
+                memcpy(&w, &row[x], sizeof(w));
+                if (w == 0)
+                    continue;
+                for (uint32_t i = 0; i < 8; i++) {
+                    if (row[x + i] != 0) {
+                        out[0] = (uint8_t)(x + i);
+                        out[1] = (uint8_t)y;
+                        out[2] = (uint8_t)z;
+                        out[3] = row[x + i];
+                        out += 4;
+                    }
+                }
+            }
+            for (; x < size_x; x++) {
+                if (row[x] != 0) {
+                    out[0] = (uint8_t)x;
+                    out[1] = (uint8_t)y;
+                    out[2] = (uint8_t)z;
+                    out[3] = row[x];
+                    out += 4;
+                }
+            }
+        }
+    }
+    ogt_assert(out == job.packed_voxel_data + job.num_voxels * 4, "packed a different number of voxels than were counted");
+}
+
+// runs job_func on each job. Jobs are about the same size and each writes only to its own job, so they're
+// handed out in order; the cost of a job is the part of its model's grid that it scans.
+static void _vox_run_xyzi_jobs(_vox_xyzi_job* jobs, uint32_t num_jobs, void (*job_func)(_vox_xyzi_job&)) {
+    uint64_t total_cost = 0;
+    for (uint32_t i = 0; i < num_jobs; i++)
+        total_cost += (uint64_t)jobs[i].model->size_x * jobs[i].model->size_y * (jobs[i].z_end - jobs[i].z_begin);
+
+    _vox_parallel_for(num_jobs, total_cost, g_write_thread_count, [&](uint32_t i) { job_func(jobs[i]); });
+}
+
+// packs the jobs whose voxels have been laid out in fp's data since the last flush, then flushes them.
+static void _vox_pack_xyzi_batch(_vox_file_writeable* fp, _vox_xyzi_job* jobs, uint32_t num_jobs) {
+    for (uint32_t i = 0; i < num_jobs; i++)
+        jobs[i].packed_voxel_data = fp->data.data + jobs[i].data_offset;
+    _vox_run_xyzi_jobs(jobs, num_jobs, _vox_pack_xyzi_job);
+    _vox_file_flush(fp, false);
+}
+
+// writes the SIZE and XYZI chunks of every model. All models are counted up front to size their chunks,
+// then their voxels are packed in file order. A streaming writer packs and flushes about
+// k_vox_write_batch_size bytes at a time; otherwise everything is packed in one batch.
+static void _vox_write_models(_vox_file_writeable* fp, const ogt_vox_scene* scene) {
+    const uint32_t k_vox_write_batch_size = 4 * 1024 * 1024;
+
+    // split each model into jobs of whole z slices.
+    _vox_array<uint32_t> slices_per_job;
+    _vox_array<uint32_t> first_job_of_model;
+    slices_per_job.resize(scene->num_models);
+    first_job_of_model.resize(scene->num_models + 1);
+    uint32_t num_jobs = 0;
     for (uint32_t i = 0; i < scene->num_models; i++) {
         const ogt_vox_model* model = scene->models[i];
         ogt_assert(model->size_x <= 256 && model->size_y <= 256 && model->size_z <= 256, "model dimensions exceed the limit of 256x256x256");
-        // count the number of solid voxels in the grid
-        uint32_t num_voxels_in_grid = model->size_x * model->size_y * model->size_z;
+        uint32_t slice_voxels = model->size_x * model->size_y;
+        uint32_t slices = slice_voxels ? k_vox_xyzi_job_voxels / slice_voxels : model->size_z;
+        slices_per_job[i] = slices ? slices : 1;
+        first_job_of_model[i] = num_jobs;
+        num_jobs += model->size_z ? (model->size_z + slices_per_job[i] - 1) / slices_per_job[i] : 1;
+    }
+    first_job_of_model[scene->num_models] = num_jobs;
+
+    _vox_array<_vox_xyzi_job> jobs;
+    jobs.resize(num_jobs);
+    for (uint32_t i = 0; i < scene->num_models; i++) {
+        const ogt_vox_model* model = scene->models[i];
+        uint32_t z = 0;
+        for (uint32_t j = first_job_of_model[i]; j < first_job_of_model[i + 1]; j++) {
+            _vox_xyzi_job& job = jobs[j];
+            job.model = model;
+            job.z_begin = z;
+            job.z_end = model->size_z - z > slices_per_job[i] ? z + slices_per_job[i] : model->size_z;
+            job.num_voxels = 0;
+            job.data_offset = 0;
+            job.packed_voxel_data = NULL;
+            z = job.z_end;
+        }
+    }
+
+    // count the number of solid voxels in each job.
+    _vox_run_xyzi_jobs(jobs.data, num_jobs, _vox_count_xyzi_job);
+
+    uint32_t first_job_of_batch = 0;
+    for (uint32_t i = 0; i < scene->num_models; i++) {
+        const ogt_vox_model* model = scene->models[i];
         uint32_t num_solid_voxels = 0;
-        for (uint32_t voxel_index = 0; voxel_index < num_voxels_in_grid; voxel_index++)
-            if (model->voxel_data[voxel_index] != 0)
-                num_solid_voxels++;
+        for (uint32_t j = first_job_of_model[i]; j < first_job_of_model[i + 1]; j++)
+            num_solid_voxels += jobs[j].num_voxels;
         uint32_t chunk_size_xyzi = sizeof(uint32_t) + 4 * num_solid_voxels;
 
         // write the SIZE chunk header
@@ -318,21 +707,42 @@ uint8_t* ogt_vox_write_scene(const ogt_vox_scene* scene, uint32_t* buffer_size)
 
         // write out XYZI chunk payload
         _vox_file_write_uint32(fp, num_solid_voxels);
-        uint32_t voxel_index = 0;
-        for (uint32_t z = 0; z < model->size_z; z++) {
-            for (uint32_t y = 0; y < model->size_y; y++) {
-                for (uint32_t x = 0; x < model->size_x; x++, voxel_index++) {
-                    uint8_t color_index = model->voxel_data[voxel_index];
-                    if (color_index != 0) {
-                        _vox_file_write_uint8(fp, (uint8_t)x);
-                        _vox_file_write_uint8(fp, (uint8_t)y);
-                        _vox_file_write_uint8(fp, (uint8_t)z);
-                        _vox_file_write_uint8(fp, color_index);
-                    }
-                }
+        if (fp->measure_only) {
+            fp->flushed_size += 4 * num_solid_voxels;
+            continue;
+        }
+        // make room for the voxels of each job; they're packed once the batch is laid out, since the data may move
+        // until then. The XYZI chunk size is already written, so a batch can end part way through a model.
+        for (uint32_t j = first_job_of_model[i]; j < first_job_of_model[i + 1]; j++) {
+            jobs[j].data_offset = (uint32_t)fp->data.count;
+            fp->data.alloc_many(4 * jobs[j].num_voxels);
+            if (fp->write_func && fp->data.count >= k_vox_write_batch_size) {
+                _vox_pack_xyzi_batch(fp, jobs.data + first_job_of_batch, j + 1 - first_job_of_batch);
+                first_job_of_batch = j + 1;
             }
         }
     }
+    if (!fp->measure_only)
+        _vox_pack_xyzi_batch(fp, jobs.data + first_job_of_batch, num_jobs - first_job_of_batch);
+}
+
+// writes the whole .vox file for the scene to fp, with the given size in the main chunk header.
+// returns the offset just past the main chunk header, from which main_chunk_child_size is counted.
+static uint32_t _vox_write_scene(_vox_file_writeable* fp, const ogt_vox_scene* scene, uint32_t main_chunk_child_size) {
+    // write file header and file version
+    _vox_file_write_uint32(fp, CHUNK_ID_VOX_);
+    _vox_file_write_uint32(fp, 150);
+
+    // write the main chunk
+    _vox_file_write_uint32(fp, CHUNK_ID_MAIN);
+    _vox_file_write_uint32(fp, 0);
+    _vox_file_write_uint32(fp, main_chunk_child_size);
+
+    // we need to know how to patch up the main chunk size after we've written everything
+    const uint32_t offset_post_main_chunk = _vox_file_get_offset(fp);
+
+    // write out all model chunks
+    _vox_write_models(fp, scene);
 
     // define our node_id ranges.
     ogt_assert(scene->num_groups > 0, "no groups found in scene");
@@ -363,6 +773,7 @@ uint8_t* ogt_vox_write_scene(const ogt_vox_scene* scene, uint32_t* buffer_size)
         uint32_t group_dict_keyvalue_count = (hidden_string ? 1 : 0);
 
         // compute the chunk size.
+        _vox_file_flush(fp, false);
         uint32_t offset_of_chunk_header = _vox_file_get_offset(fp);
 
         // write the nGRP header
@@ -391,6 +802,7 @@ uint8_t* ogt_vox_write_scene(const ogt_vox_scene* scene, uint32_t* buffer_size)
     for (uint32_t i = 0; i < scene->num_instances; i++) {
         const ogt_vox_instance* instance = &scene->instances[i];
 
+        _vox_file_flush(fp, false);
         uint32_t offset_of_chunk_header = _vox_file_get_offset(fp);
         // write the nSHP chunk header
         _vox_file_write_uint32(fp, CHUNK_ID_nSHP);
@@ -466,6 +878,7 @@ uint8_t* ogt_vox_write_scene(const ogt_vox_scene* scene, uint32_t* buffer_size)
             break;
         }
 
+        _vox_file_flush(fp, false);
         uint32_t offset_of_chunk_header = _vox_file_get_offset(fp);
 
         // write the rCAM header
@@ -494,6 +907,8 @@ uint8_t* ogt_vox_write_scene(const ogt_vox_scene* scene, uint32_t* buffer_size)
         for (uint32_t i = 0; i < 256; i++)
             rotated_palette.color[i] = scene->palette.color[(i + 1) & 255];
 
+        _vox_file_flush(fp, false);
+
         // write the palette chunk header
         _vox_file_write_uint32(fp, CHUNK_ID_RGBA);
         _vox_file_write_uint32(fp, sizeof(ogt_vox_palette));
@@ -528,6 +943,7 @@ uint8_t* ogt_vox_write_scene(const ogt_vox_scene* scene, uint32_t* buffer_size)
             matl_dict_keyvalue_count += (matl.content_flags & k_ogt_vox_matl_have_g) ? 1 : 0;
             matl_dict_keyvalue_count += (matl.content_flags & k_ogt_vox_matl_have_media) ? 1 : 0;
 
+            _vox_file_flush(fp, false);
             uint32_t offset_of_chunk_header = _vox_file_get_offset(fp);
 
             // write the material chunk header
@@ -597,6 +1013,7 @@ uint8_t* ogt_vox_write_scene(const ogt_vox_scene* scene, uint32_t* buffer_size)
         layer_dict_keyvalue_count += (hidden_string ? 1 : 0);
         layer_dict_keyvalue_count += 1; // color_string
 
+        _vox_file_flush(fp, false);
         uint32_t offset_of_chunk_header = _vox_file_get_offset(fp);
 
         // write the layer chunk header
@@ -616,6 +1033,18 @@ uint8_t* ogt_vox_write_scene(const ogt_vox_scene* scene, uint32_t* buffer_size)
         _vox_file_write_at_offset(fp, offset_of_chunk_header + 4, &chunk_size, sizeof(chunk_size));
     }
 
+    return offset_post_main_chunk;
+}
+
+// saves the scene out to a buffer that when saved as a .vox file can be loaded with magicavoxel.
+uint8_t* ogt_vox_write_scene(const ogt_vox_scene* scene, uint32_t* buffer_size) {
+    _vox_file_writeable file;
+    _vox_file_writeable_init(&file);
+    _vox_file_writeable* fp = &file;
+
+    // the main_chunk_child_size will get patched up once everything is written.
+    const uint32_t offset_post_main_chunk = _vox_write_scene(fp, scene, 0);
+
     // we deliberately don't free the fp->data field, just pass the buffer pointer and size out to the caller
     *buffer_size = (uint32_t)fp->data.count;
     uint8_t* buffer_data = _vox_file_get_data(fp);
@@ -631,6 +1060,25 @@ uint8_t* ogt_vox_write_scene(const ogt_vox_scene* scene, uint32_t* buffer_size)
     return buffer_data;
 }
 
+// streams the scene out through write_func, holding only about k_vox_write_flush_size bytes of it at a time.
+// a sink can't be seeked back to patch the main chunk size, so a first pass only measures the file.
+bool ogt_vox_write_scene_to_stream(const ogt_vox_scene* scene, ogt_vox_write_func write_func, void* user_data) {
+    ogt_assert(write_func, "write_func must not be NULL");
+    uint32_t main_chunk_child_size;
+    {
+        _vox_file_writeable measure;
+        _vox_file_writeable_init(&measure, NULL, NULL, true);
+        const uint32_t offset_post_main_chunk = _vox_write_scene(&measure, scene, 0);
+        main_chunk_child_size = _vox_file_get_offset(&measure) - offset_post_main_chunk;
+    }
+
+    _vox_file_writeable file;
+    _vox_file_writeable_init(&file, write_func, user_data);
+    _vox_write_scene(&file, scene, main_chunk_child_size);
+    _vox_file_flush(&file, true);
+    return !file.failed;
+}
+
 
 // internal math/helper utilities
 static inline uint32_t _vox_max(uint32_t a, uint32_t b) {
@@ -666,11 +1114,18 @@ static const void* _vox_file_data_pointer(const _vox_file* fp) {
 }
 
 // hash utilities
-static uint32_t _vox_hash(const uint8_t* data, uint32_t data_size) {
-    uint32_t hash = 0;
-    for (uint32_t i = 0; i < data_size; i++)
-        hash = data[i] + (hash * 65559);
-    return hash;
+// a model's hash is the sum of a well-mixed 64-bit value for each of its solid voxels, so it can be
+// built up one voxel at a time in any order, eg. while unpacking an XYZI chunk, and empty space costs nothing.
+static inline uint64_t _vox_hash_voxel(uint32_t voxel_index, uint8_t color_index) {
+    // splitmix64 finalizer over (index, color)
+    uint64_t h = ((uint64_t)voxel_index << 8) | color_index;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    return h ^ (h >> 31);
+}
+
+static inline uint32_t _vox_hash_finish(uint64_t hash) {
+    return (uint32_t)(hash ^ (hash >> 32));
 }
 
 
@@ -679,6 +1134,12 @@ static void* _vox_realloc(void* old_ptr, size_t old_size, size_t new_size) {
     if (new_size && old_size >= new_size)
         return old_ptr;
 
+    // the array that grew last can usually just be extended within the arena.
+    if (g_thread_arena && new_size && _vox_arena_grow(g_thread_arena, old_ptr, new_size)) {
+        memset((uint8_t*)old_ptr + old_size, 0, new_size - old_size);
+        return old_ptr;
+    }
+
     // memcpy from the old ptr only if both sides are valid.
     void* new_ptr = _vox_malloc(new_size);
     if (new_ptr) {
@@ -1041,6 +1502,23 @@ uint32_t ogt_vox_sample_instance_model(const ogt_vox_instance* instance, uint32_
 
 
 
+void ogt_vox_set_read_thread_count(uint32_t thread_count) {
+    g_read_thread_count = thread_count;
+}
+
+void ogt_vox_set_write_thread_count(uint32_t thread_count) {
+    g_write_thread_count = thread_count;
+}
+
+void ogt_vox_set_arena_allocation(bool enabled) {
+    g_arena_allocation = enabled;
+    // release this thread's scratch arena. other threads release theirs when they exit.
+    if (!enabled && g_scratch_arena_cache.arena) {
+        _vox_arena_destroy(g_scratch_arena_cache.arena);
+        g_scratch_arena_cache.arena = NULL;
+    }
+}
+
 void* ogt_vox_malloc(size_t size) {
     return _vox_malloc(size);
 }
@@ -1240,16 +1718,20 @@ ogt_vox_scene* ogt_vox_merge_scenes(const ogt_vox_scene** scenes, uint32_t scene
             uint8_t* override_voxel_data = (uint8_t*)&override_model[1];
 
             // remap all color indices in the cloned model so they reference the master palette now!
+            // and hash the remapped voxels as we go.
+            uint64_t hash = 0;
             for (uint32_t voxel_index = 0; voxel_index < voxel_count; voxel_index++) {
                 uint8_t  old_color_index = model->voxel_data[voxel_index];
                 uint32_t new_color_index = scene_color_index_to_master_map[old_color_index];
                 ogt_assert(new_color_index < 256, "color index out of bounds");
                 override_voxel_data[voxel_index] = (uint8_t)new_color_index;
+                if (new_color_index)
+                    hash += _vox_hash_voxel(voxel_index, (uint8_t)new_color_index);
             }
             // assign the new model.
             *override_model = *model;
             override_model->voxel_data = override_voxel_data;
-            override_model->voxel_hash = _vox_hash(override_voxel_data, voxel_count);
+            override_model->voxel_hash = _vox_hash_finish(hash);
 
             models[num_models++] = override_model;
         }
@@ -1392,7 +1874,126 @@ ogt_vox_scene* ogt_vox_merge_scenes(const ogt_vox_scene** scenes, uint32_t scene
 
 
 
+// a model whose XYZI chunk has been located but not yet unpacked into its dense grid.
+struct _vox_model_decode_job {
+    ogt_vox_model* model;
+    const uint8_t* packed_voxel_data;   // points into the caller's buffer
+    uint32_t       num_voxels;          // already clamped to what the buffer holds
+};
+
+// unpacks one model's XYZI voxels into its (zeroed) dense grid, hashing them on the way.
+static void _vox_decode_model(const _vox_model_decode_job& job) {
+    ogt_vox_model* model = job.model;
+    uint8_t* voxel_data = (uint8_t*)&model[1];
+    const uint32_t size_x = model->size_x;
+    const uint32_t size_y = model->size_y;
+    const uint32_t size_z = model->size_z;
+
+    // setup some strides for computing voxel index based on x/y/z
+    const uint32_t k_stride_x = 1;
+    const uint32_t k_stride_y = size_x;
+    const uint32_t k_stride_z = size_x * size_y;
+
+    // compute the hash of the voxels in this model-- used to accelerate duplicate models checking.
+    // a voxel that is written twice only counts with its final color, so the hash depends only on
+    // the finished grid.
+    uint64_t hash = 0;
+    const uint8_t* packed_voxel_data = job.packed_voxel_data;
+    for (uint32_t i = 0; i < job.num_voxels; i++) {
+        uint8_t x = packed_voxel_data[i * 4 + 0];
+        uint8_t y = packed_voxel_data[i * 4 + 1];
+        uint8_t z = packed_voxel_data[i * 4 + 2];
+        uint8_t color_index = packed_voxel_data[i * 4 + 3];
+        ogt_assert(x < size_x&& y < size_y&& z < size_z, "invalid data in XYZI chunk");
+        uint32_t voxel_index = (x * k_stride_x) + (y * k_stride_y) + (z * k_stride_z);
+        uint8_t old_color_index = voxel_data[voxel_index];
+        if (old_color_index)
+            hash -= _vox_hash_voxel(voxel_index, old_color_index);
+        if (color_index)
+            hash += _vox_hash_voxel(voxel_index, color_index);
+        voxel_data[voxel_index] = color_index;
+    }
+    model->voxel_hash = _vox_hash_finish(hash);
+}
+
+// the cost of a job is its packed voxels; the dense grid is only touched where they land.
+static uint64_t _vox_decode_job_cost(const _vox_model_decode_job& job) {
+    return (uint64_t)job.num_voxels;
+}
+
+static int _vox_compare_decode_jobs_by_cost(const void* lhs, const void* rhs) {
+    uint64_t lhs_cost = _vox_decode_job_cost(*(const _vox_model_decode_job*)lhs);
+    uint64_t rhs_cost = _vox_decode_job_cost(*(const _vox_model_decode_job*)rhs);
+    return lhs_cost > rhs_cost ? -1 : (lhs_cost < rhs_cost ? 1 : 0);
+}
+
+// unpacks all of the models, spreading them over threads if there is enough work. Each job writes
+// only to its own model, so the jobs can run in any order.
+static void _vox_decode_models(_vox_array<_vox_model_decode_job>& jobs) {
+    uint64_t total_cost = 0;
+    for (uint32_t i = 0; i < jobs.size(); i++)
+        total_cost += _vox_decode_job_cost(jobs[i]);
+
+    // hand out the biggest models first so that one big model found late doesn't hold up the rest.
+    if (jobs.size() > 1)
+        qsort(jobs.data, jobs.size(), sizeof(_vox_model_decode_job), _vox_compare_decode_jobs_by_cost);
+
+    _vox_parallel_for((uint32_t)jobs.size(), total_cost, g_read_thread_count, [&](uint32_t i) { _vox_decode_model(jobs[i]); });
+}
+
+// estimates the arena sizes for a scene by walking its chunk headers. The scene's arena mostly holds the dense
+// grid of each model, which is known exactly. The scratch arena holds what the other chunks expand into.
+static void _vox_estimate_arena_sizes(const uint8_t* buffer, uint32_t buffer_size, size_t* scene_arena_size, size_t* scratch_arena_size) {
+    _vox_file file = { buffer, buffer_size, 8 };    // skip the file header
+    _vox_file* fp = &file;
+    size_t model_bytes = 0;
+    size_t node_bytes = 0;
+    size_t other_bytes = 0;
+    uint32_t size[3] = { 0, 0, 0 };
+    while (_vox_file_bytes_remaining(fp) >= sizeof(uint32_t) * 3) {
+        uint32_t chunk_id = 0;
+        uint32_t chunk_size = 0;
+        uint32_t chunk_child_size = 0;
+        _vox_file_read(fp, &chunk_id, sizeof(uint32_t));
+        _vox_file_read(fp, &chunk_size, sizeof(uint32_t));
+        _vox_file_read(fp, &chunk_child_size, sizeof(uint32_t));
+        // MAIN has no content of its own; its children follow it as ordinary chunks.
+        if (chunk_id == CHUNK_ID_MAIN)
+            continue;
+        if (chunk_id == CHUNK_ID_SIZE && chunk_size == sizeof(size))
+            memcpy(size, _vox_file_data_pointer(fp), _vox_min(sizeof(size), _vox_file_bytes_remaining(fp)));
+        else if (chunk_id == CHUNK_ID_XYZI)
+            model_bytes += _vox_arena_align(sizeof(ogt_vox_model) + (size_t)size[0] * size[1] * size[2]);
+        else if (chunk_id == CHUNK_ID_nTRN || chunk_id == CHUNK_ID_nGRP || chunk_id == CHUNK_ID_nSHP)
+            node_bytes += chunk_size;
+        else
+            other_bytes += chunk_size;
+        _vox_file_seek_forwards(fp, chunk_size);
+    }
+    // the scene's palette and materials are a fixed size, and its instances, groups and names have room
+    // reserved for them once they are known, if these 16KB aren't enough.
+    *scene_arena_size = model_bytes + _vox_arena_align(sizeof(ogt_vox_scene)) + 16 * 1024;
+    // scene graph chunks expand the most: into nodes, instances, groups and names, held in arrays that
+    // leave their old storage behind in the arena as they grow. 128KB covers the arrays' initial reserves.
+    *scratch_arena_size = node_bytes * 20 + other_bytes * 2 + 128 * 1024;
+}
+
 const ogt_vox_scene* ogt_vox_read_scene_with_flags(const uint8_t* buffer, uint32_t buffer_size, uint32_t read_flags) {
+    // with arena allocation, the parsing state below is allocated from the scratch arena, so its scope must
+    // be declared first, and the scene's arena before that. If an arena can't be had, the allocator is used.
+    _vox_arena* new_scene_arena = NULL;
+    _vox_arena* scratch_arena = NULL;
+    if (g_arena_allocation && buffer_size >= 8) {
+        size_t scene_arena_size = 0;
+        size_t scratch_arena_size = 0;
+        _vox_estimate_arena_sizes(buffer, buffer_size, &scene_arena_size, &scratch_arena_size);
+        new_scene_arena = _vox_arena_create(scene_arena_size);
+        scratch_arena = new_scene_arena ? _vox_get_scratch_arena(scratch_arena_size) : NULL;
+    }
+    _vox_arena_scope scene_arena_scope(new_scene_arena);
+    _vox_thread_arena_scope scratch_arena_scope(scratch_arena);
+    _vox_arena* scene_arena = scratch_arena ? new_scene_arena : NULL;
+
     _vox_file file = { buffer, buffer_size, 0 };
     _vox_file* fp = &file;
 
@@ -1405,6 +2006,7 @@ const ogt_vox_scene* ogt_vox_read_scene_with_flags(const uint8_t* buffer, uint32
     _vox_array<ogt_vox_layer>    layers;
     _vox_array<ogt_vox_group>    groups;
     _vox_array<uint32_t>         child_ids;
+    _vox_array<_vox_model_decode_job> decode_jobs;
     ogt_vox_palette              palette;
     ogt_vox_matl_array           materials;
     _vox_dictionary              dict;
@@ -1416,6 +2018,7 @@ const ogt_vox_scene* ogt_vox_read_scene_with_flags(const uint8_t* buffer, uint32
 
     // size some of our arrays to prevent resizing during the parsing for smallish cases.
     model_ptrs.reserve(64);
+    decode_jobs.reserve(64);
     instances.reserve(256);
     cameras.reserve(4);
     child_ids.reserve(256);
@@ -1478,7 +2081,7 @@ const ogt_vox_scene* ogt_vox_read_scene_with_flags(const uint8_t* buffer, uint32
             _vox_file_read(fp, &num_voxels_in_chunk, sizeof(uint32_t));
             if (num_voxels_in_chunk != 0 || (read_flags & k_read_scene_flags_keep_empty_models_instances)) {
                 uint32_t voxel_count = size_x * size_y * size_z;
-                ogt_vox_model* model = (ogt_vox_model*)_vox_calloc(sizeof(ogt_vox_model) + voxel_count);        // 1 byte for each voxel
+                ogt_vox_model* model = (ogt_vox_model*)_vox_scene_calloc(scene_arena, sizeof(ogt_vox_model) + voxel_count);        // 1 byte for each voxel
                 if (!model)
                     return NULL;
                 uint8_t* voxel_data = (uint8_t*)&model[1];
@@ -1492,25 +2095,15 @@ const ogt_vox_scene* ogt_vox_read_scene_with_flags(const uint8_t* buffer, uint32
                 model->size_z = size_z;
                 model->voxel_data = voxel_data;
 
-                // setup some strides for computing voxel index based on x/y/z
-                const uint32_t k_stride_x = 1;
-                const uint32_t k_stride_y = size_x;
-                const uint32_t k_stride_z = size_x * size_y;
-
-                // read this many voxels and store it in voxel data.
-                const uint8_t* packed_voxel_data = (const uint8_t*)_vox_file_data_pointer(fp);
-                const uint32_t voxels_to_read = _vox_min(_vox_file_bytes_remaining(fp) / 4, num_voxels_in_chunk);
-                for (uint32_t i = 0; i < voxels_to_read; i++) {
-                    uint8_t x = packed_voxel_data[i * 4 + 0];
-                    uint8_t y = packed_voxel_data[i * 4 + 1];
-                    uint8_t z = packed_voxel_data[i * 4 + 2];
-                    uint8_t color_index = packed_voxel_data[i * 4 + 3];
-                    ogt_assert(x < size_x&& y < size_y&& z < size_z, "invalid data in XYZI chunk");
-                    voxel_data[(x * k_stride_x) + (y * k_stride_y) + (z * k_stride_z)] = color_index;
-                }
+                // just note where the voxels are for now. They are unpacked and hashed after all chunks
+                // have been read, when every model is known and they can be unpacked in parallel.
+                _vox_model_decode_job job;
+                job.model = model;
+                job.packed_voxel_data = (const uint8_t*)_vox_file_data_pointer(fp);
+                job.num_voxels = _vox_min(_vox_file_bytes_remaining(fp) / 4, num_voxels_in_chunk);
+                decode_jobs.push_back(job);
+
                 _vox_file_seek_forwards(fp, num_voxels_in_chunk * 4);
-                // compute the hash of the voxels in this model-- used to accelerate duplicate models checking.
-                model->voxel_hash = _vox_hash(voxel_data, size_x * size_y * size_z);
             }
             else {
                 model_ptrs.push_back(NULL);
@@ -1897,6 +2490,9 @@ const ogt_vox_scene* ogt_vox_read_scene_with_flags(const uint8_t* buffer, uint32
         } // end switch
     }
 
+    // unpack the voxels of every model found above.
+    _vox_decode_models(decode_jobs);
+
     // ok, now that we've parsed all scene nodes - walk the scene hierarchy, and generate instances
     // we can't do this while parsing chunks unfortunately because some chunks reference chunks
     // that are later in the file than them.
@@ -2077,7 +2673,7 @@ const ogt_vox_scene* ogt_vox_read_scene_with_flags(const uint8_t* buffer, uint32
             if (!model_ptrs[j] || !_vox_models_are_equal(model_ptrs[i], model_ptrs[j]))
                 continue;
             // model i and model j are the same, so free model j and keep model i.
-            _vox_free(model_ptrs[j]);
+            _vox_scene_free(scene_arena, model_ptrs[j]);
             model_ptrs[j] = NULL;
             // remap all instances that were referring to j to now refer to i.
             for (uint32_t k = 0; k < instances.size(); k++) {
@@ -2139,7 +2735,18 @@ const ogt_vox_scene* ogt_vox_read_scene_with_flags(const uint8_t* buffer, uint32
 
     // finally, construct the output scene..
     size_t scene_size = sizeof(ogt_vox_scene) + misc_data.size();
-    ogt_vox_scene* scene = (ogt_vox_scene*)_vox_calloc(scene_size);
+    if (scene_arena) {
+        // everything that's left fits in one block, if not the one the models are in.
+        size_t output_size = _vox_arena_align(scene_size) +
+            _vox_arena_align(sizeof(ogt_vox_instance) * instances.size()) +
+            _vox_arena_align(sizeof(ogt_vox_cam) * cameras.size()) +
+            _vox_arena_align(sizeof(ogt_vox_model*) * model_ptrs.size()) +
+            _vox_arena_align(sizeof(ogt_vox_layer) * layers.size()) +
+            _vox_arena_align(sizeof(ogt_vox_group) * groups.size());
+        if (!_vox_arena_reserve(scene_arena, output_size))
+            return NULL;
+    }
+    ogt_vox_scene* scene = (ogt_vox_scene*)_vox_scene_calloc(scene_arena, scene_size);
     {
         // copy name data into the scene
         char* scene_misc_data = (char*)&scene[1];
@@ -2147,7 +2754,7 @@ const ogt_vox_scene* ogt_vox_read_scene_with_flags(const uint8_t* buffer, uint32
 
         // copy instances over to scene
         size_t num_scene_instances = instances.size();
-        ogt_vox_instance* scene_instances = (ogt_vox_instance*)_vox_malloc(sizeof(ogt_vox_instance) * num_scene_instances);
+        ogt_vox_instance* scene_instances = (ogt_vox_instance*)_vox_scene_malloc(scene_arena, sizeof(ogt_vox_instance) * num_scene_instances);
         if (num_scene_instances) {
             memcpy(scene_instances, &instances[0], sizeof(ogt_vox_instance) * num_scene_instances);
         }
@@ -2156,7 +2763,7 @@ const ogt_vox_scene* ogt_vox_read_scene_with_flags(const uint8_t* buffer, uint32
 
         // copy cameras over to scene
         size_t num_scene_cameras = cameras.size();
-        ogt_vox_cam* scene_cameras = (ogt_vox_cam*)_vox_malloc(sizeof(ogt_vox_cam) * num_scene_cameras);
+        ogt_vox_cam* scene_cameras = (ogt_vox_cam*)_vox_scene_malloc(scene_arena, sizeof(ogt_vox_cam) * num_scene_cameras);
         if (num_scene_cameras) {
             memcpy(scene_cameras, &cameras[0], sizeof(ogt_vox_cam) * num_scene_cameras);
         }
@@ -2165,7 +2772,7 @@ const ogt_vox_scene* ogt_vox_read_scene_with_flags(const uint8_t* buffer, uint32
 
         // copy model pointers over to the scene,
         size_t num_scene_models = model_ptrs.size();
-        ogt_vox_model** scene_models = (ogt_vox_model**)_vox_malloc(sizeof(ogt_vox_model*) * num_scene_models);
+        ogt_vox_model** scene_models = (ogt_vox_model**)_vox_scene_malloc(scene_arena, sizeof(ogt_vox_model*) * num_scene_models);
         if (num_scene_models)
             memcpy(scene_models, &model_ptrs[0], sizeof(ogt_vox_model*) * num_scene_models);
         scene->models = (const ogt_vox_model**)scene_models;
@@ -2173,14 +2780,14 @@ const ogt_vox_scene* ogt_vox_read_scene_with_flags(const uint8_t* buffer, uint32
 
         // copy layer pointers over to the scene
         size_t num_scene_layers = layers.size();
-        ogt_vox_layer* scene_layers = (ogt_vox_layer*)_vox_malloc(sizeof(ogt_vox_layer) * num_scene_layers);
+        ogt_vox_layer* scene_layers = (ogt_vox_layer*)_vox_scene_malloc(scene_arena, sizeof(ogt_vox_layer) * num_scene_layers);
         memcpy(scene_layers, &layers[0], sizeof(ogt_vox_layer) * num_scene_layers);
         scene->layers = scene_layers;
         scene->num_layers = (uint32_t)num_scene_layers;
 
         // copy group pointers over to the scene
         size_t num_scene_groups = groups.size();
-        ogt_vox_group* scene_groups = num_scene_groups ? (ogt_vox_group*)_vox_malloc(sizeof(ogt_vox_group) * num_scene_groups) : NULL;
+        ogt_vox_group* scene_groups = num_scene_groups ? (ogt_vox_group*)_vox_scene_malloc(scene_arena, sizeof(ogt_vox_group) * num_scene_groups) : NULL;
         if (num_scene_groups)
             memcpy(scene_groups, &groups[0], sizeof(ogt_vox_group) * num_scene_groups);
         scene->groups = scene_groups;
@@ -2214,6 +2821,9 @@ const ogt_vox_scene* ogt_vox_read_scene_with_flags(const uint8_t* buffer, uint32
 
         // copy the materials.
         scene->materials = materials;
+
+        // the scene now owns its arena, if it has one.
+        scene->arena = scene_arena ? scene_arena_scope.release() : NULL;
     }
     return scene;
 }
\ No newline at end of file
@@ -56,6 +56,10 @@
         uint8_t* out_buffer = ogt_vox_write_scene(merged_scene, &out_buffer_size);
         // save out_buffer to disk as a .vox file (it has length out_buffer_size)
 
+       or, for big scenes, stream it to disk without holding the whole file in memory:
+
+        ogt_vox_write_scene_to_stream(merged_scene, my_write_func, my_file);
+
     4. destroy the merged scene:
 
         ogt_vox_destroy_scene(merged_scene);
@@ -394,6 +398,7 @@ static void _vox_free(void* old_ptr);
         ogt_vox_matl_array      materials;      // the extended materials for this scene
         uint32_t                num_cameras;    // number of cameras for this scene
         const ogt_vox_cam*      cameras;        // the cameras for this scene
+        void*                   arena;          // if the scene was read with arena allocation enabled, the arena that holds all of it. NULL otherwise.
     } ogt_vox_scene;
 
     // allocate memory function interface. pass in size, and get a pointer to memory with at least that size available.
@@ -407,6 +412,20 @@ static void _vox_free(void* old_ptr);
     void* ogt_vox_malloc(size_t size);
     void  ogt_vox_free(void* mem);
 
+    // if enabled, ogt_vox_read_scene bump-allocates each scene out of one region taken from the memory allocator
+    // above (plus more regions only if its size estimate falls short), and ogt_vox_destroy_scene releases the whole
+    // region at once. The parts of such a scene must not be freed individually. The parsing state goes in a
+    // scratch region that each thread keeps for its next read, until it exits or disables this. Disabled by default.
+    void  ogt_vox_set_arena_allocation(bool enabled);
+
+    // set how many threads ogt_vox_read_scene may use to unpack model voxels. 0 (the default) uses one per
+    // hardware thread, 1 unpacks everything on the calling thread. Small scenes are always unpacked on the calling thread.
+    void  ogt_vox_set_read_thread_count(uint32_t thread_count);
+
+    // set how many threads ogt_vox_write_scene and ogt_vox_write_scene_to_stream may use to pack model voxels.
+    // 0 (the default) uses one per hardware thread. The output doesn't depend on the thread count.
+    void  ogt_vox_set_write_thread_count(uint32_t thread_count);
+
     // flags for ogt_vox_read_scene_with_flags
     static const uint32_t k_read_scene_flags_groups                      = 1 << 0; // if not specified, all instance transforms will be flattened into world space. If specified, will read group information and keep all transforms as local transform relative to the group they are in.
     static const uint32_t k_read_scene_flags_keyframes                   = 1 << 1; // if specified, all instances and groups will contain keyframe data.
@@ -425,6 +444,13 @@ static void _vox_free(void* old_ptr);
     // writes the scene to a new buffer and returns the buffer size. free the buffer with ogt_vox_free
     uint8_t* ogt_vox_write_scene(const ogt_vox_scene* scene, uint32_t* buffer_size);
 
+    // stream writer interface. called with consecutive pieces of the .vox file, in order. return false to abort the write.
+    typedef bool (*ogt_vox_write_func)(const void* data, uint32_t data_size, void* user_data);
+
+    // writes the same bytes as ogt_vox_write_scene, but hands them to write_func a piece at a time instead of building
+    // the whole file in memory. returns false if write_func failed, in which case it was not called again after that.
+    bool ogt_vox_write_scene_to_stream(const ogt_vox_scene* scene, ogt_vox_write_func write_func, void* user_data);
+
     // merges the specified scenes together to create a bigger scene. Merged scene can be destroyed using ogt_vox_destroy_scene
     // If you require specific colors in the merged scene palette, provide up to and including 255 of them via required_colors/required_color_count.
     ogt_vox_scene* ogt_vox_merge_scenes(const ogt_vox_scene** scenes, uint32_t scene_count, const ogt_vox_rgba* required_colors, const uint32_t required_color_count);
@@ -458,6 +484,8 @@ static void _vox_free(void* old_ptr);
     #include <stdlib.h>
     #include <string.h>
     #include <stdio.h>
+    #include <thread>
+    #include <atomic>
 
     // MAKE_VOX_CHUNK_ID: used to construct a literal to describe a chunk in a .vox file.
     #define MAKE_VOX_CHUNK_ID(c0,c1,c2,c3)     ( (c0<<0) | (c1<<8) | (c2<<16) | (c3<<24) )